@@ -37,7 +37,9 @@ struct device_priv {
 	char *devname;				/* name of the ugen(4) node */
 	int fd;					/* device file descriptor */
 
-	unsigned char *cdesc;			/* active config descriptor */
+	unsigned char *fdesc;			/* all config descriptors */
+	size_t fdesclen;
+	unsigned char *cdesc;			/* active one, within fdesc */
 	usb_device_descriptor_t ddesc;		/* usb device descriptor */
 };
 
@@ -85,11 +87,28 @@ static int obsd_clock_gettime(int, struct timespec *);
  */
 static int _errno_to_libusb(int);
 static int _cache_active_config_descriptor(struct libusb_device *);
+static usb_config_descriptor_t *_config_descriptor(unsigned char *, size_t,
+    int);
 static int _do_control_transfer(struct usbi_transfer *);
 static int _do_gen_transfer(struct usbi_transfer *itransfer);
 static int _access_endpoint(struct libusb_transfer *);
 
 static int _bus_open(int);
+static int _bus_append_cached(struct libusb_context *, int,
+    struct discovered_devs **);
+
+#define USB_MAX_BUSES	8
+
+/*
+ * Devices found on each bus by the last full listing, valid as long
+ * as the hotplug generation of the bus did not change.
+ */
+static struct {
+	int		valid;
+	uint32_t	gen;
+	int		ndevs;
+	unsigned long	sessions[USB_MAX_DEVICES];
+} _bus_cache[USB_MAX_BUSES];
 
 
 const struct usbi_os_backend openbsd_backend = {
@@ -150,32 +169,61 @@ obsd_get_device_list(struct libusb_context * ctx,
 	struct libusb_device *dev;
 	struct device_priv *dpriv;
 	struct usb_device_info di;
-	struct usb_device_ddesc dd;
+	struct usb_bus_device *ubd;
+	struct usb_bus_snapshot ubs;
 	unsigned long session_id;
-	char devices[USB_MAX_DEVICES];
+	uint32_t gen;
 	char busnode[16];
 	char *udevname;
-	int fd, addr, i, j;
+	int fd, k, i, j, err, havegen;
 
 	usbi_dbg("");
 
-	for (i = 0; i < 8; i++) {
+	ubd = calloc(USB_MAX_DEVICES, sizeof(*ubd));
+	if (ubd == NULL)
+		return (LIBUSB_ERROR_NO_MEM);
+
+	for (i = 0; i < USB_MAX_BUSES; i++) {
 		snprintf(busnode, sizeof(busnode), USBDEV "%d", i);
 
 		if ((fd = open(busnode, O_RDWR)) < 0) {
 			if (errno != ENOENT && errno != ENXIO)
 				usbi_err(ctx, "could not open %s", busnode);
+			_bus_cache[i].valid = 0;
 			continue;
 		}
 
-		bzero(devices, sizeof(devices));
-		for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
-			if (devices[addr])
+		/* Nothing was plugged or unplugged since the last time. */
+		havegen = (ioctl(fd, USB_GET_GENERATION, &gen) == 0);
+		if (havegen && _bus_cache[i].valid &&
+		    _bus_cache[i].gen == gen) {
+			err = _bus_append_cached(ctx, i, discdevs);
+			if (err == LIBUSB_ERROR_NO_MEM) {
+				close(fd);
+				free(ubd);
+				return (err);
+			}
+			if (err == LIBUSB_SUCCESS) {
+				close(fd);
 				continue;
+			}
+		}
+		_bus_cache[i].valid = 0;
+		_bus_cache[i].ndevs = 0;
+
+		/* All devices of the bus and their descriptors at once. */
+		ubs.ubs_count = USB_MAX_DEVICES;
+		ubs.ubs_devs = ubd;
+		if (ioctl(fd, USB_BUS_SNAPSHOT, &ubs) < 0) {
+			usbi_err(ctx, "could not list devices on %s", busnode);
+			close(fd);
+			continue;
+		}
+		if (ubs.ubs_count > USB_MAX_DEVICES)
+			ubs.ubs_count = USB_MAX_DEVICES;
 
-			di.udi_addr = addr;
-			if (ioctl(fd, USB_DEVICEINFO, &di) < 0)
-				continue;
+		for (k = 0; k < ubs.ubs_count; k++) {
+			di = ubd[k].ubd_info;
 
 			/*
 			 * XXX If ugen(4) is attached to the USB device
@@ -195,6 +243,7 @@ obsd_get_device_list(struct libusb_context * ctx,
 				dev = usbi_alloc_device(ctx, session_id);
 				if (dev == NULL) {
 					close(fd);
+					free(ubd);
 					return (LIBUSB_ERROR_NO_MEM);
 				}
 
@@ -204,16 +253,10 @@ obsd_get_device_list(struct libusb_context * ctx,
 
 				dpriv = (struct device_priv *)dev->os_priv;
 				dpriv->fd = -1;
+				dpriv->fdesc = NULL;
 				dpriv->cdesc = NULL;
 				dpriv->devname = udevname;
-
-				dd.udd_bus = di.udi_bus;
-				dd.udd_addr = di.udi_addr;
-				if (ioctl(fd, USB_DEVICE_GET_DDESC, &dd) < 0) {
-					libusb_unref_device(dev);
-					continue;
-				}
-				dpriv->ddesc = dd.udd_desc;
+				dpriv->ddesc = ubd[k].ubd_ddesc;
 
 				if (_cache_active_config_descriptor(dev)) {
 					libusb_unref_device(dev);
@@ -229,17 +272,22 @@ obsd_get_device_list(struct libusb_context * ctx,
 			ddd = discovered_devs_append(*discdevs, dev);
 			if (ddd == NULL) {
 				close(fd);
+				free(ubd);
 				return (LIBUSB_ERROR_NO_MEM);
 			}
 			libusb_unref_device(dev);
 
 			*discdevs = ddd;
-			devices[addr] = 1;
+			_bus_cache[i].sessions[_bus_cache[i].ndevs++] =
+			    session_id;
 		}
 
 		close(fd);
+		_bus_cache[i].gen = gen;
+		_bus_cache[i].valid = havegen;
 	}
 
+	free(ubd);
 	return (LIBUSB_SUCCESS);
 }
 
@@ -331,26 +379,19 @@ int
 obsd_get_config_descriptor(struct libusb_device *dev, uint8_t idx,
     unsigned char *buf, size_t len, int *host_endian)
 {
-	struct usb_device_fdesc udf;
-	int fd, err;
+	struct device_priv *dpriv = (struct device_priv *)dev->os_priv;
+	usb_config_descriptor_t *ucd;
 
-	if ((fd = _bus_open(dev->bus_number)) < 0)
-		return _errno_to_libusb(errno);
+	/* Fetched along with the active one, no need to ask again. */
+	ucd = _config_descriptor(dpriv->fdesc, dpriv->fdesclen, idx);
+	if (ucd == NULL)
+		return _errno_to_libusb(EINVAL);
 
-	udf.udf_bus = dev->bus_number;
-	udf.udf_addr = dev->device_address;
-	udf.udf_config_index = idx;
-	udf.udf_size = len;
-	udf.udf_data = buf;
+	len = MIN(len, UGETW(ucd->wTotalLength));
 
-	usbi_dbg("index %d, len %d", udf.udf_config_index, len);
+	usbi_dbg("index %d, len %d", idx, len);
 
-	if (ioctl(fd, USB_DEVICE_GET_FDESC, &udf) < 0) {
-		err = errno;
-		close(fd);
-		return _errno_to_libusb(err);
-	}
-	close(fd);
+	memcpy(buf, ucd, len);
 
 	*host_endian = 0;
 
@@ -490,7 +531,7 @@ obsd_destroy_device(struct libusb_device *dev)
 
 	usbi_dbg("");
 
-	free(dpriv->cdesc);
+	free(dpriv->fdesc);
 	free(dpriv->devname);
 }
 
@@ -769,55 +810,88 @@ int
 _cache_active_config_descriptor(struct libusb_device *dev)
 {
 	struct device_priv *dpriv = (struct device_priv *)dev->os_priv;
-	struct usb_device_cdesc udc;
-	struct usb_device_fdesc udf;
-	unsigned char* buf;
-	int fd, len, err;
+	struct usb_device_alldesc uad;
+	usb_config_descriptor_t *ucd;
+	unsigned char *buf = NULL, *nbuf;
+	size_t len = 1024;
+	int fd, err;
 
 	if ((fd = _bus_open(dev->bus_number)) < 0)
 		return _errno_to_libusb(errno);
 
 	usbi_dbg("fd %d, addr %d", fd, dev->device_address);
 
-	udc.udc_bus = dev->bus_number;
-	udc.udc_addr = dev->device_address;
-	udc.udc_config_index = USB_CURRENT_CONFIG_INDEX;
-	if (ioctl(fd, USB_DEVICE_GET_CDESC, &udc) < 0) {
-		err = errno;
-		close(fd);
-		return _errno_to_libusb(errno);
-	}
-
-	usbi_dbg("active bLength %d", udc.udc_desc.bLength);
-
-	len = UGETW(udc.udc_desc.wTotalLength);
-	buf = malloc(len);
-	if (buf == NULL)
-		return (LIBUSB_ERROR_NO_MEM);
+	/*
+	 * Every configuration in one go.  The size needed is returned
+	 * if the buffer is too small, so retry with that.
+	 */
+	for (;;) {
+		if ((nbuf = realloc(buf, len)) == NULL) {
+			close(fd);
+			free(buf);
+			return (LIBUSB_ERROR_NO_MEM);
+		}
+		buf = nbuf;
 
-	udf.udf_bus = dev->bus_number;
-	udf.udf_addr = dev->device_address;
-	udf.udf_config_index = udc.udc_config_index;
-	udf.udf_size = len;
-	udf.udf_data = buf;
+		uad.uad_bus = dev->bus_number;
+		uad.uad_addr = dev->device_address;
+		uad.uad_size = len;
+		uad.uad_data = buf;
+		if (ioctl(fd, USB_DEVICE_GET_ALLDESC, &uad) < 0) {
+			err = errno;
+			close(fd);
+			free(buf);
+			return _errno_to_libusb(err);
+		}
+		if (uad.uad_size <= len)
+			break;
+		len = uad.uad_size;
+	}
+	close(fd);
 
-	usbi_dbg("index %d, len %d", udf.udf_config_index, len);
+	usbi_dbg("active index %d, len %d", uad.uad_config_index,
+	    uad.uad_size);
 
-	if (ioctl(fd, USB_DEVICE_GET_FDESC, &udf) < 0) {
-		err = errno;
-		close(fd);
+	ucd = _config_descriptor(buf, uad.uad_size, uad.uad_config_index);
+	if (ucd == NULL) {
 		free(buf);
-		return _errno_to_libusb(err);
+		return _errno_to_libusb(EINVAL);
 	}
-	close(fd);
 
-	if (dpriv->cdesc)
-		free(dpriv->cdesc);
-	dpriv->cdesc = buf;
+	free(dpriv->fdesc);
+	dpriv->fdesc = buf;
+	dpriv->fdesclen = uad.uad_size;
+	dpriv->cdesc = (unsigned char *)ucd;
 
 	return (LIBUSB_SUCCESS);
 }
 
+/*
+ * Find configuration idx in descriptor sets stored back to back.
+ */
+usb_config_descriptor_t *
+_config_descriptor(unsigned char *buf, size_t len, int idx)
+{
+	usb_config_descriptor_t *ucd;
+	size_t off = 0, total;
+	int i;
+
+	if (buf == NULL || idx < 0)
+		return (NULL);
+
+	for (i = 0; off + USB_CONFIG_DESCRIPTOR_SIZE <= len; i++) {
+		ucd = (usb_config_descriptor_t *)(buf + off);
+		total = UGETW(ucd->wTotalLength);
+		if (total < USB_CONFIG_DESCRIPTOR_SIZE || total > len - off)
+			return (NULL);
+		if (i == idx)
+			return (ucd);
+		off += total;
+	}
+
+	return (NULL);
+}
+
 int
 _do_control_transfer(struct usbi_transfer *itransfer)
 {
@@ -949,6 +1023,45 @@ _do_gen_transfer(struct usbi_transfer *itransfer)
 	return (0);
 }
 
+/*
+ * Add the devices of the last full listing of a bus.  All or nothing:
+ * if one of them is unknown to ctx the bus has to be listed again.
+ * The references taken by the lookup are held until all are added,
+ * so that no device can go away in between.
+ */
+int
+_bus_append_cached(struct libusb_context *ctx, int bus,
+    struct discovered_devs **discdevs)
+{
+	struct libusb_device *devs[USB_MAX_DEVICES];
+	struct discovered_devs *ddd;
+	int err = LIBUSB_SUCCESS;
+	int k, n;
+
+	for (n = 0; n < _bus_cache[bus].ndevs; n++) {
+		devs[n] = usbi_get_device_by_session_id(ctx,
+		    _bus_cache[bus].sessions[n]);
+		if (devs[n] == NULL) {
+			err = LIBUSB_ERROR_NOT_FOUND;
+			goto out;
+		}
+	}
+
+	for (k = 0; k < n; k++) {
+		ddd = discovered_devs_append(*discdevs, devs[k]);
+		if (ddd == NULL) {
+			err = LIBUSB_ERROR_NO_MEM;
+			break;
+		}
+		*discdevs = ddd;
+	}
+
+out:
+	for (k = 0; k < n; k++)
+		libusb_unref_device(devs[k]);
+	return (err);
+}
+
 int
 _bus_open(int number)
 {
@@ -1335,6 +1335,7 @@ ugen_do_ioctl(struct ugen_softc *sc, int endpt, u_long cmd, caddr_t addr,
 		err = ugen_set_config(sc, *(int *)addr);
 		switch (err) {
 		case USBD_NORMAL_COMPLETION:
+			usb_config_changed(sc->sc_udev);
 			break;
 		case USBD_IN_USE:
 			return (EBUSY);
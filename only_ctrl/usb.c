@@ -44,6 +44,7 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/kernel.h>
+#include <sys/proc.h>
 #include <sys/malloc.h>
 #include <sys/device.h>
 #include <sys/timeout.h>
@@ -55,6 +56,7 @@
 #include <sys/signalvar.h>
 #include <sys/time.h>
 #include <sys/rwlock.h>
+#include <sys/vnode.h>
 
 #include <dev/usb/usb.h>
 #include <dev/usb/usbdi.h>
@@ -88,6 +90,17 @@ int	usb_noexplore = 0;
 #define DPRINTFN(n,x)
 #endif
 
+#define USB_NEVENTS	64		/* hotplug events kept */
+
+/* A device as of the last scan, to tell what changed. */
+struct usb_seen {
+	struct usbd_device	*us_dev;
+	u_int8_t		 us_config;
+	u_int8_t		 us_hubaddr;	/* upstream hub, 0 for none */
+	u_int16_t		 us_vendorNo;
+	u_int16_t		 us_productNo;
+};
+
 struct usb_softc {
 	struct device	 sc_dev;	/* base device */
 	struct usbd_bus  *sc_bus;	/* USB controller */
@@ -98,8 +111,51 @@ struct usb_softc {
 
 	struct timeval	 sc_ptime;
 
-	TAILQ_HEAD(, usb_request_block) complete_queue_head;
-	struct selinfo rsel;
+	int		 sc_refcnt;	/* readers sleeping for events */
+
+	LIST_HEAD(, usb_client) sc_clients;
+
+	struct rwlock	 sc_snaplock;	/* protects sc_snap */
+	struct usb_dsnap *sc_snap[USB_MAX_DEVICES];
+	u_int		 sc_snapgen[USB_MAX_DEVICES]; /* bumped on changes */
+
+	struct usb_event sc_events[USB_NEVENTS];
+	u_int32_t	 sc_evgen;	/* generation of the last event */
+	struct usb_seen	 sc_seen[USB_MAX_DEVICES];
+};
+
+/*
+ * What the descriptor ioctls report about a device, fetched once on
+ * the task thread.  A snapshot is never changed, only replaced when
+ * the device, its generation or the configuration differ.
+ */
+struct usb_dsnap {
+	struct usbd_device	*uds_dev;	/* device it describes */
+	u_int			 uds_gen;	/* sc_snapgen when taken */
+	int			 uds_failed;	/* descriptors missing */
+	u_int8_t		 uds_config;
+	struct usb_device_info	 uds_info;
+	usb_device_descriptor_t	 uds_ddesc;
+	int			 uds_config_index; /* active, or -1 */
+	u_char			*uds_fdesc;	/* all configurations */
+	u_int			 uds_fdesclen;
+};
+
+/*
+ * Async requests issued through the bus device, kept per process so
+ * that completions go back to their submitter.  There is no per-open
+ * state on /dev/usbN to hang them off.
+ */
+struct usb_client {
+	LIST_ENTRY(usb_client) uc_next;
+	struct process	*uc_ps;		/* owner, while uc_pid finds it */
+	pid_t		 uc_pid;
+	int		 uc_dead;	/* owner gone, never matched again */
+	int		 uc_inflight;	/* submitted, not completed yet */
+	int		 uc_events;	/* hotplug events wanted */
+	u_int32_t	 uc_evgen;	/* last hotplug event read */
+	TAILQ_HEAD(, usb_request_block) uc_complete;
+	struct selinfo	 uc_rsel;
 };
 
 struct rwlock usbpalock;
@@ -114,6 +170,11 @@ int explore_pending;
 const char *usbrev_str[] = USBREV_STR;
 
 void usb_async_callback(struct usbd_xfer *, void *, usbd_status);
+struct usb_client *usb_get_client(struct usb_softc *, struct proc *, int);
+void		 usb_free_client(struct usb_client *);
+void		 usb_scan_devices(struct usb_softc *);
+void		 usb_post_event(struct usb_softc *, int, int,
+		    struct usb_seen *);
 void		 usb_explore(void *);
 void		 usb_create_task_threads(void *);
 void		 usb_task_thread(void *);
@@ -121,9 +182,11 @@ struct proc	*usb_task_thread_proc = NULL;
 void		 usb_abort_task_thread(void *);
 struct proc	*usb_abort_task_thread_proc = NULL;
 
-void		 usb_fill_di_task(void *);
-void		 usb_fill_udc_task(void *);
-void		 usb_fill_udf_task(void *);
+void		 usb_fill_snap_task(void *);
+struct usb_dsnap *usb_snap_enter(struct usb_softc *, int);
+void		 usb_snap_exit(struct usb_softc *);
+void		 usb_snap_free(struct usb_dsnap *);
+usb_config_descriptor_t *usb_snap_cdesc(struct usb_dsnap *, int);
 
 int		 usb_match(struct device *, void *, void *);
 void		 usb_attach(struct device *, struct device *, void *);
@@ -147,6 +210,7 @@ usbpoll(dev_t dev, int events, struct proc *p)
 {
 	int unit = minor(dev);
 	struct usb_softc *sc;
+	struct usb_client *uc;
 	int revents = 0;
 	int s;
 
@@ -154,13 +218,17 @@ usbpoll(dev_t dev, int events, struct proc *p)
 		return (ENXIO);
 	sc = usb_cd.cd_devs[unit];
 
+	if (!(events & (POLLIN | POLLRDNORM)))
+		return (0);
+	/* Clients are made at open, nothing to wait for without one. */
+	if ((uc = usb_get_client(sc, p, 0)) == NULL)
+		return (0);
 	s = splusb();
-	if (events & (POLLIN | POLLRDNORM)) {
-		if (!TAILQ_EMPTY(&sc->complete_queue_head))
-			revents |= events & (POLLIN | POLLRDNORM);
-		else
-			selrecord(p, &sc->rsel);
-	}
+	if (!TAILQ_EMPTY(&uc->uc_complete) ||
+	    (uc->uc_events && uc->uc_evgen != sc->sc_evgen))
+		revents |= events & (POLLIN | POLLRDNORM);
+	else
+		selrecord(p, &uc->uc_rsel);
 	splx(s);
 	return (revents);
 }
@@ -169,11 +237,77 @@ void
 usb_async_callback(struct usbd_xfer *xfer, void *priv, usbd_status s)
 {
 	struct usb_request_block *ur = priv;
-	struct usb_softc *sc = ur->urb_sc;
+	struct usb_client *uc = ur->urb_sc;
 
 	ur->urb_status = xfer->status;
-	TAILQ_INSERT_TAIL(&sc->complete_queue_head, ur, entries);
-	selwakeup(&sc->rsel);
+	uc->uc_inflight--;
+	TAILQ_INSERT_TAIL(&uc->uc_complete, ur, entries);
+	selwakeup(&uc->uc_rsel);
+}
+
+/*
+ * Find the async request state of the calling process, optionally
+ * creating it.  Liveness is checked before matching, so that a process
+ * reusing the pid of one that is gone never gets its completions.
+ * Clients of processes that are gone are freed on the way, once none
+ * of their requests is in flight.
+ */
+struct usb_client *
+usb_get_client(struct usb_softc *sc, struct proc *p, int create)
+{
+	struct usb_client *uc, *nuc, *new = NULL;
+	struct process *pr = p->p_p;
+
+again:
+	LIST_FOREACH_SAFE(uc, &sc->sc_clients, uc_next, nuc) {
+		if (!uc->uc_dead && prfind(uc->uc_pid) != uc->uc_ps)
+			uc->uc_dead = 1;
+		if (uc->uc_dead) {
+			if (uc->uc_inflight == 0) {
+				LIST_REMOVE(uc, uc_next);
+				usb_free_client(uc);
+			}
+			continue;
+		}
+		if (uc->uc_ps == pr)
+			break;
+	}
+	if (uc != NULL || !create) {
+		if (new != NULL)
+			free(new, M_USBDEV, sizeof(*new));
+		return (uc);
+	}
+	if (new == NULL) {
+		/* malloc may sleep, look again afterwards. */
+		new = malloc(sizeof(*new), M_USBDEV, M_WAITOK | M_ZERO);
+		new->uc_ps = pr;
+		new->uc_pid = pr->ps_pid;
+		new->uc_evgen = sc->sc_evgen;
+		TAILQ_INIT(&new->uc_complete);
+		goto again;
+	}
+	LIST_INSERT_HEAD(&sc->sc_clients, new, uc_next);
+	return (new);
+}
+
+/*
+ * Free a client and the completions it did not collect.  Nothing may
+ * be in flight.
+ */
+void
+usb_free_client(struct usb_client *uc)
+{
+	struct usb_request_block *kurb;
+	int s;
+
+	s = splusb();
+	while ((kurb = TAILQ_FIRST(&uc->uc_complete)) != NULL) {
+		TAILQ_REMOVE(&uc->uc_complete, kurb, entries);
+		usbd_free_xfer(kurb->urb_xfer);
+		free(kurb, M_TEMP, sizeof(*kurb));
+	}
+	splx(s);
+	free(uc, M_USBDEV, sizeof(*uc));
 }
 
 int
@@ -201,7 +335,8 @@ usb_attach(struct device *parent, struct device *self, void *aux)
 	sc->sc_bus = aux;
 	sc->sc_bus->usbctl = self;
 	sc->sc_port.power = USB_MAX_POWER;
-	TAILQ_INIT(&sc->complete_queue_head);
+	LIST_INIT(&sc->sc_clients);
+	rw_init(&sc->sc_snaplock, "usbsnap");
 
 	usbrev = sc->sc_bus->usbrev;
 	printf(": USB revision %s", usbrev_str[usbrev]);
@@ -534,84 +669,295 @@ usbopen(dev_t dev, int flag, int mode, struct proc *p)
 	if (sc->sc_bus->dying)
 		return (EIO);
 
+	/* Get the client now, usbpoll must not sleep allocating it. */
+	usb_get_client(sc, p, 1);
 	return (0);
 }
 
 int
 usbclose(dev_t dev, int flag, int mode, struct proc *p)
 {
+	struct usb_softc *sc = usb_cd.cd_devs[minor(dev)];
+	struct usb_client *uc, *nuc;
+
+	/* Clients with requests in flight go once those complete. */
+	LIST_FOREACH_SAFE(uc, &sc->sc_clients, uc_next, nuc) {
+		if (uc->uc_inflight == 0) {
+			LIST_REMOVE(uc, uc_next);
+			usb_free_client(uc);
+		}
+	}
 	return (0);
 }
 
+struct usb_snap_arg {
+	struct usb_softc	*usa_sc;
+	int			 usa_addr;
+	struct usb_dsnap	*usa_snap;
+};
+
+/*
+ * Compare the devices on the bus with what was there last time and
+ * queue an event for each difference.
+ */
 void
-usb_fill_di_task(void *arg)
+usb_scan_devices(struct usb_softc *sc)
 {
-	struct usb_device_info *di = (struct usb_device_info *)arg;
-	struct usb_softc *sc;
 	struct usbd_device *dev;
+	struct usb_seen *us;
+	int addr;
 
-	/* check that the bus and device are still present */
-	if (di->udi_bus >= usb_cd.cd_ndevs)
-		return;
-	sc = usb_cd.cd_devs[di->udi_bus];
-	if (sc == NULL)
-		return;
-	dev = sc->sc_bus->devices[di->udi_addr];
-	if (dev == NULL)
-		return;
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		dev = sc->sc_bus->devices[addr];
+		us = &sc->sc_seen[addr];
+		if (us->us_dev == dev) {
+			if (dev != NULL && us->us_config != dev->config) {
+				us->us_config = dev->config;
+				usb_post_event(sc, USB_EVENT_CONFIG, addr, us);
+			}
+			continue;
+		}
+		if (us->us_dev != NULL)
+			usb_post_event(sc, USB_EVENT_DETACH, addr, us);
+		us->us_dev = dev;
+		if (dev == NULL)
+			continue;
+		us->us_config = dev->config;
+		us->us_hubaddr = dev->myhub != NULL ? dev->myhub->address : 0;
+		us->us_vendorNo = UGETW(dev->ddesc.idVendor);
+		us->us_productNo = UGETW(dev->ddesc.idProduct);
+		usb_post_event(sc, USB_EVENT_ATTACH, addr, us);
+	}
+}
+
+void
+usb_post_event(struct usb_softc *sc, int type, int addr, struct usb_seen *us)
+{
+	struct usb_event *ue;
+	struct usb_client *uc;
+
+	sc->sc_evgen++;
+	ue = &sc->sc_events[sc->sc_evgen % USB_NEVENTS];
+	ue->ue_gen = sc->sc_evgen;
+	ue->ue_type = type;
+	ue->ue_bus = sc->sc_dev.dv_unit;
+	ue->ue_addr = addr;
+	ue->ue_config = us->us_config;
+	ue->ue_vendorNo = us->us_vendorNo;
+	ue->ue_productNo = us->us_productNo;
+	DPRINTF(("%s: event %u type %d addr %d\n", sc->sc_dev.dv_xname,
+	    ue->ue_gen, type, addr));
+
+	/*
+	 * Retake the snapshots of the device and of its hub, whose port
+	 * status changed too.  Snapshots in use are only freed under the
+	 * write lock, so no lock is needed to mark them stale.
+	 */
+	sc->sc_snapgen[addr]++;
+	sc->sc_snapgen[us->us_hubaddr]++;
+
+	LIST_FOREACH(uc, &sc->sc_clients, uc_next)
+		selwakeup(&uc->uc_rsel);
+	wakeup(&sc->sc_evgen);
+}
+
+int
+usbread(dev_t dev, struct uio *uio, int flag)
+{
+	struct usb_softc *sc = usb_cd.cd_devs[minor(dev)];
+	struct usb_client *uc;
+	struct usb_event ue;
+	int error = 0;
 
-	usbd_fill_deviceinfo(dev, di, 1);
+	if (uio->uio_resid < sizeof(ue))
+		return (EINVAL);
+	if (sc->sc_bus->dying)
+		return (EIO);
+
+	uc = usb_get_client(sc, curproc, 0);
+	if (uc == NULL || !uc->uc_events)
+		return (EINVAL);
+	sc->sc_refcnt++;
+	while (uc->uc_evgen == sc->sc_evgen) {
+		if (flag & IO_NDELAY) {
+			error = EWOULDBLOCK;
+			goto out;
+		}
+		error = tsleep(&sc->sc_evgen, PZERO | PCATCH, "usbevt", 0);
+		if (sc->sc_bus->dying)
+			error = EIO;
+		if (error)
+			goto out;
+	}
+
+	while (uc->uc_evgen != sc->sc_evgen && uio->uio_resid >= sizeof(ue)) {
+		/* Skip what fell off the queue, ue_gen shows the gap. */
+		if (sc->sc_evgen - uc->uc_evgen > USB_NEVENTS)
+			uc->uc_evgen = sc->sc_evgen - USB_NEVENTS;
+		ue = sc->sc_events[(uc->uc_evgen + 1) % USB_NEVENTS];
+		error = uiomovei(&ue, sizeof(ue), uio);
+		if (error)
+			break;
+		uc->uc_evgen++;
+	}
+out:
+	if (--sc->sc_refcnt < 0)
+		usb_detach_wakeup(&sc->sc_dev);
+	return (error);
 }
 
 void
-usb_fill_udc_task(void *arg)
+usb_fill_snap_task(void *arg)
 {
-	struct usb_device_cdesc *udc = (struct usb_device_cdesc *)arg;
-	struct usb_softc *sc;
+	struct usb_snap_arg *usa = arg;
+	struct usb_softc *sc = usa->usa_sc;
+	usb_config_descriptor_t **cdescs;
 	struct usbd_device *dev;
-	int addr = udc->udc_addr;
-	usb_config_descriptor_t *cdesc;
+	struct usb_dsnap *snap;
+	u_int size = 0, off = 0;
+	int i, nconf, *lens;
 
-	/* check that the bus and device are still present */
-	if (udc->udc_bus >= usb_cd.cd_ndevs)
-		return;
-	sc = usb_cd.cd_devs[udc->udc_bus];
-	if (sc == NULL)
-		return;
-	dev = sc->sc_bus->devices[udc->udc_addr];
+	dev = sc->sc_bus->devices[usa->usa_addr];
 	if (dev == NULL)
 		return;
 
-	cdesc = usbd_get_cdesc(sc->sc_bus->devices[addr],
-	    udc->udc_config_index, 0);
-	if (cdesc == NULL)
+	snap = malloc(sizeof(*snap), M_USBDEV, M_WAITOK | M_ZERO);
+	snap->uds_dev = dev;
+	snap->uds_gen = sc->sc_snapgen[usa->usa_addr];
+	snap->uds_config = dev->config;
+	snap->uds_config_index = -1;
+	usbd_fill_deviceinfo(dev, &snap->uds_info, 1);
+	snap->uds_info.udi_bus = sc->sc_dev.dv_unit;
+	snap->uds_info.udi_addr = usa->usa_addr;
+	snap->uds_ddesc = *usbd_get_device_descriptor(dev);
+	usa->usa_snap = snap;
+
+	/* Without descriptors only the device info can be served. */
+	nconf = snap->uds_ddesc.bNumConfigurations;
+	if (nconf == 0)
 		return;
-	udc->udc_desc = *cdesc;
-	free(cdesc, M_TEMP, 0);
+	cdescs = mallocarray(nconf, sizeof(*cdescs), M_TEMP,
+	    M_WAITOK | M_ZERO);
+	lens = mallocarray(nconf, sizeof(*lens), M_TEMP, M_WAITOK);
+	for (i = 0; i < nconf; i++) {
+		cdescs[i] = usbd_get_cdesc(dev, i, &lens[i]);
+		if (cdescs[i] == NULL) {
+			snap->uds_failed = 1;
+			goto out;
+		}
+		if (dev->config != USB_UNCONFIG_NO &&
+		    cdescs[i]->bConfigurationValue == dev->config)
+			snap->uds_config_index = i;
+		size += lens[i];
+	}
+
+	snap->uds_fdesc = malloc(size, M_USBDEV, M_WAITOK);
+	snap->uds_fdesclen = size;
+	for (i = 0; i < nconf; i++) {
+		memcpy(snap->uds_fdesc + off, cdescs[i], lens[i]);
+		off += lens[i];
+	}
+out:
+	for (i = 0; i < nconf; i++)
+		if (cdescs[i] != NULL)
+			free(cdescs[i], M_TEMP, 0);
+	free(lens, M_TEMP, nconf * sizeof(*lens));
+	free(cdescs, M_TEMP, nconf * sizeof(*cdescs));
 }
 
-void
-usb_fill_udf_task(void *arg)
+/*
+ * Return the snapshot of the device at addr with sc_snaplock held for
+ * reading, or NULL if there is no device.  Only a missing or stale
+ * snapshot costs a trip through the task thread.  One that lacks the
+ * descriptors because fetching them failed serves only the call that
+ * took it and is never reused.
+ */
+struct usb_dsnap *
+usb_snap_enter(struct usb_softc *sc, int addr)
 {
-	struct usb_device_fdesc *udf = (struct usb_device_fdesc *)arg;
-	struct usb_softc *sc;
+	struct usb_snap_arg usa;
+	struct usb_task snap_task;
+	struct usb_dsnap *snap, *fresh = NULL;
 	struct usbd_device *dev;
-	int addr = udf->udf_addr;
-	usb_config_descriptor_t *cdesc;
+	int tries;
 
-	/* check that the bus and device are still present */
-	if (udf->udf_bus >= usb_cd.cd_ndevs)
-		return;
-	sc = usb_cd.cd_devs[udf->udf_bus];
-	if (sc == NULL)
-		return;
-	dev = sc->sc_bus->devices[udf->udf_addr];
-	if (dev == NULL)
-		return;
+	for (tries = 0; tries < 2; tries++) {
+		rw_enter_read(&sc->sc_snaplock);
+		dev = sc->sc_bus->devices[addr];
+		if (dev == NULL) {
+			rw_exit_read(&sc->sc_snaplock);
+			return (NULL);
+		}
+		snap = sc->sc_snap[addr];
+		if (snap != NULL && snap->uds_dev == dev &&
+		    snap->uds_gen == sc->sc_snapgen[addr] &&
+		    snap->uds_config == dev->config &&
+		    (!snap->uds_failed || snap == fresh))
+			return (snap);
+		rw_exit_read(&sc->sc_snaplock);
+
+		usa.usa_sc = sc;
+		usa.usa_addr = addr;
+		usa.usa_snap = NULL;
+		usb_init_task(&snap_task, usb_fill_snap_task, &usa,
+		    USB_TASK_TYPE_GENERIC);
+		usb_add_task(sc->sc_bus->root_hub, &snap_task);
+		usb_wait_task(sc->sc_bus->root_hub, &snap_task);
+		if (usa.usa_snap == NULL)
+			return (NULL);
+
+		rw_enter_write(&sc->sc_snaplock);
+		snap = sc->sc_snap[addr];
+		sc->sc_snap[addr] = fresh = usa.usa_snap;
+		rw_exit_write(&sc->sc_snaplock);
+		if (snap != NULL)
+			usb_snap_free(snap);
+	}
+
+	/* Changed again while we were looking. */
+	return (NULL);
+}
 
-	cdesc = usbd_get_cdesc(sc->sc_bus->devices[addr],
-	    udf->udf_config_index, &udf->udf_size);
-	udf->udf_data = (char *)cdesc;
+void
+usb_snap_exit(struct usb_softc *sc)
+{
+	rw_exit_read(&sc->sc_snaplock);
+}
+
+void
+usb_snap_free(struct usb_dsnap *snap)
+{
+	if (snap->uds_fdesc != NULL)
+		free(snap->uds_fdesc, M_USBDEV, snap->uds_fdesclen);
+	free(snap, M_USBDEV, sizeof(*snap));
+}
+
+/*
+ * Find a configuration in a snapshot, USB_CURRENT_CONFIG_INDEX being
+ * the active one.
+ */
+usb_config_descriptor_t *
+usb_snap_cdesc(struct usb_dsnap *snap, int index)
+{
+	usb_config_descriptor_t *cdesc;
+	u_int off = 0, len;
+	int i;
+
+	if (index == USB_CURRENT_CONFIG_INDEX)
+		index = snap->uds_config_index;
+	if (index < 0 || snap->uds_fdesc == NULL)
+		return (NULL);
+
+	for (i = 0; off < snap->uds_fdesclen; i++) {
+		cdesc = (usb_config_descriptor_t *)(snap->uds_fdesc + off);
+		if (i == index)
+			return (cdesc);
+		len = UGETW(cdesc->wTotalLength);
+		if (len == 0)
+			break;
+		off += len;
+	}
+	return (NULL);
 }
 
 int
@@ -651,6 +997,7 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 	{
 		struct usb_request_block *urb = (void *)data;
 		struct usb_request_block *kurb;
+		struct usb_client *uc;
 		int len = urb->urb_actlen;
 		struct usbd_xfer *xfer;
 		struct iovec iov;
@@ -659,6 +1006,7 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 		int addr = urb->urb_addr;
 		usbd_status err;
 		int error = 0;
+		int s;
 
 		if (!(flag & FWRITE))
 			return (EBADF);
@@ -746,30 +1094,37 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 			usbd_free_xfer(xfer);
 			return (error);
 		}
-		urb->urb_sc = sc;
+		uc = usb_get_client(sc, p, 1);
 		kurb = malloc(sizeof(*kurb), M_TEMP, M_WAITOK);
 		if (kurb == NULL) {
 			usbd_free_xfer(xfer);
 			return (ENOMEM);
 		}
 		*kurb = *urb;
+		kurb->urb_sc = uc;
 		kurb->urb_xfer = xfer;
 		usbd_setup_default_xfer(xfer,
 		    sc->sc_bus->devices[addr], kurb, urb->urb_timeout,
 		    &urb->urb_request, NULL, len,
 		    urb->urb_flags | USBD_NO_COPY, usb_async_callback);
+		s = splusb();
+		uc->uc_inflight++;
 		err = usbd_transfer(xfer);
 		if (err != USBD_IN_PROGRESS) {
+			uc->uc_inflight--;
+			splx(s);
 			free(kurb, M_TEMP, sizeof(*kurb));
 			usbd_free_xfer(xfer);
 			return (EIO);
 		}
+		splx(s);
 		return (error);
 	}
 	case USB_COMPLETED:
 	{
 		struct usb_request_block *urb = (void *)data;
 		struct usb_request_block *kurb;
+		struct usb_client *uc;
 		struct usbd_xfer *xfer;
 		void *buf;
 		struct uio uio;
@@ -778,13 +1133,16 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 		int s;
 		int error = 0;
 
+		/* Only completions of requests this process submitted. */
+		if ((uc = usb_get_client(sc, p, 0)) == NULL)
+			return (EIO);
 		s = splusb();
-		kurb = TAILQ_FIRST(&sc->complete_queue_head);
+		kurb = TAILQ_FIRST(&uc->uc_complete);
 		if (kurb == NULL) {
 			splx(s);
 			return (EIO);
 		}
-		TAILQ_REMOVE(&sc->complete_queue_head, kurb, entries);
+		TAILQ_REMOVE(&uc->uc_complete, kurb, entries);
 		splx(s);
 
 		xfer = kurb->urb_xfer;
@@ -823,38 +1181,78 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 	{
 		struct usb_device_info *di = (void *)data;
 		int addr = di->udi_addr;
-		struct usb_task di_task;
-		struct usbd_device *dev;
+		struct usb_dsnap *snap;
 
 		if (addr < 1 || addr >= USB_MAX_DEVICES)
 			return (EINVAL);
 
-		dev = sc->sc_bus->devices[addr];
-		if (dev == NULL)
+		if ((snap = usb_snap_enter(sc, addr)) == NULL)
 			return (ENXIO);
-
-		di->udi_bus = unit;
+		*di = snap->uds_info;
+		usb_snap_exit(sc);
 
 		/* All devices get a driver, thanks to ugen(4).  If the
-		 * task ends without adding a driver name, there was an error.
+		 * snapshot has no driver name, there was an error.
 		 */
-		di->udi_devnames[0][0] = '\0';
-
-		usb_init_task(&di_task, usb_fill_di_task, di,
-		    USB_TASK_TYPE_GENERIC);
-		usb_add_task(sc->sc_bus->root_hub, &di_task);
-		usb_wait_task(sc->sc_bus->root_hub, &di_task);
-
 		if (di->udi_devnames[0][0] == '\0')
 			return (ENXIO);
 
 		break;
 	}
 
+	case USB_BUS_SNAPSHOT:
+	{
+		struct usb_bus_snapshot *ubs = (void *)data;
+		struct usb_bus_device *devs;
+		struct usb_dsnap *snap;
+		int addr, count = 0;
+		size_t size;
+
+		if (ubs->ubs_count < 0)
+			return (EINVAL);
+
+		size = (USB_MAX_DEVICES - 1) * sizeof(*devs);
+		devs = malloc(size, M_TEMP, M_WAITOK);
+		for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+			if ((snap = usb_snap_enter(sc, addr)) == NULL)
+				continue;
+			/* Same as USB_DEVICEINFO: no driver name, no device. */
+			if (snap->uds_info.udi_devnames[0][0] != '\0') {
+				devs[count].ubd_info = snap->uds_info;
+				devs[count].ubd_ddesc = snap->uds_ddesc;
+				count++;
+			}
+			usb_snap_exit(sc);
+		}
+
+		/* Copy out what fits, but report every device. */
+		error = copyout(devs, ubs->ubs_devs,
+		    min(ubs->ubs_count, count) * sizeof(*devs));
+		ubs->ubs_count = count;
+		free(devs, M_TEMP, size);
+		return (error);
+	}
+
 	case USB_DEVICESTATS:
 		*(struct usb_device_stats *)data = sc->sc_bus->stats;
 		break;
 
+	case USB_GET_GENERATION:
+		*(u_int32_t *)data = sc->sc_evgen;
+		break;
+
+	case USB_SET_EVENTS:
+	{
+		struct usb_client *uc;
+
+		uc = usb_get_client(sc, p, 1);
+		/* Only events from now on are read. */
+		if (*(int *)data && !uc->uc_events)
+			uc->uc_evgen = sc->sc_evgen;
+		uc->uc_events = *(int *)data != 0;
+		break;
+	}
+
 	case USB_DEVICE_GET_DDESC:
 	{
 		struct usb_device_ddesc *udd = (struct usb_device_ddesc *)data;
@@ -878,21 +1276,21 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 	{
 		struct usb_device_cdesc *udc = (struct usb_device_cdesc *)data;
 		int addr = udc->udc_addr;
-		struct usb_task udc_task;
+		usb_config_descriptor_t *cdesc;
+		struct usb_dsnap *snap;
 
 		if (addr < 1 || addr >= USB_MAX_DEVICES)
 			return (EINVAL);
-		if (sc->sc_bus->devices[addr] == NULL)
-			return (ENXIO);
 
 		udc->udc_bus = unit;
 
-		udc->udc_desc.bLength = 0;
-		usb_init_task(&udc_task, usb_fill_udc_task, udc,
-		    USB_TASK_TYPE_GENERIC);
-		usb_add_task(sc->sc_bus->root_hub, &udc_task);
-		usb_wait_task(sc->sc_bus->root_hub, &udc_task);
-		if (udc->udc_desc.bLength == 0)
+		if ((snap = usb_snap_enter(sc, addr)) == NULL)
+			return (ENXIO);
+		cdesc = usb_snap_cdesc(snap, udc->udc_config_index);
+		if (cdesc != NULL)
+			udc->udc_desc = *cdesc;
+		usb_snap_exit(sc);
+		if (cdesc == NULL)
 			return (EINVAL);
 		break;
 	}
@@ -901,43 +1299,52 @@ usbioctl(dev_t devt, u_long cmd, caddr_t data, int flag, struct proc *p)
 	{
 		struct usb_device_fdesc *udf = (struct usb_device_fdesc *)data;
 		int addr = udf->udf_addr;
-		struct usb_task udf_task;
-		struct usb_device_fdesc save_udf;
 		usb_config_descriptor_t *cdesc;
-		struct iovec iov;
-		struct uio uio;
-		int len, error;
+		struct usb_dsnap *snap;
+		u_int len;
 
 		if (addr < 1 || addr >= USB_MAX_DEVICES)
 			return (EINVAL);
-		if (sc->sc_bus->devices[addr] == NULL)
-			return (ENXIO);
 
 		udf->udf_bus = unit;
 
-		save_udf = *udf;
-		usb_init_task(&udf_task, usb_fill_udf_task, udf,
-		    USB_TASK_TYPE_GENERIC);
-		usb_add_task(sc->sc_bus->root_hub, &udf_task);
-		usb_wait_task(sc->sc_bus->root_hub, &udf_task);
-		len = udf->udf_size;
-		cdesc = (usb_config_descriptor_t *)udf->udf_data;
-		*udf = save_udf;
-		if (cdesc == NULL)
+		if ((snap = usb_snap_enter(sc, addr)) == NULL)
+			return (ENXIO);
+		cdesc = usb_snap_cdesc(snap, udf->udf_config_index);
+		if (cdesc == NULL) {
+			usb_snap_exit(sc);
+			return (EINVAL);
+		}
+		len = min(udf->udf_size, UGETW(cdesc->wTotalLength));
+		error = copyout(cdesc, udf->udf_data, len);
+		usb_snap_exit(sc);
+		return (error);
+	}
+
+	case USB_DEVICE_GET_ALLDESC:
+	{
+		struct usb_device_alldesc *uad = (void *)data;
+		int addr = uad->uad_addr;
+		struct usb_dsnap *snap;
+
+		if (addr < 1 || addr >= USB_MAX_DEVICES)
+			return (EINVAL);
+
+		uad->uad_bus = unit;
+
+		if ((snap = usb_snap_enter(sc, addr)) == NULL)
+			return (ENXIO);
+		if (snap->uds_fdesc == NULL) {
+			usb_snap_exit(sc);
 			return (EINVAL);
-		if (len > udf->udf_size)
-			len = udf->udf_size;
-		iov.iov_base = (caddr_t)udf->udf_data;
-		iov.iov_len = len;
-		uio.uio_iov = &iov;
-		uio.uio_iovcnt = 1;
-		uio.uio_resid = len;
-		uio.uio_offset = 0;
-		uio.uio_segflg = UIO_USERSPACE;
-		uio.uio_rw = UIO_READ;
-		uio.uio_procp = p;
-		error = uiomovei((void *)cdesc, len, &uio);
-		free(cdesc, M_TEMP, 0);
+		}
+		uad->uad_ddesc = snap->uds_ddesc;
+		uad->uad_config_index = snap->uds_config_index;
+		if (snap->uds_fdesclen <= uad->uad_size)
+			error = copyout(snap->uds_fdesc, uad->uad_data,
+			    snap->uds_fdesclen);
+		uad->uad_size = snap->uds_fdesclen;
+		usb_snap_exit(sc);
 		return (error);
 	}
 
@@ -1009,6 +1416,8 @@ usb_explore(void *v)
 	} else {
 		sc->sc_bus->root_hub->hub->explore(sc->sc_bus->root_hub);
 	}
+	/* Devices may have come or gone. */
+	usb_scan_devices(sc);
 
 	if (sc->sc_bus->flags & USB_BUS_CONFIG_PENDING) {
 		DPRINTF(("%s: %s: first explore done\n", __func__,
@@ -1036,6 +1445,18 @@ usb_needs_explore(struct usbd_device *dev, int first_explore)
 	usb_add_task(dev, &usbctl->sc_explore_task);
 }
 
+/*
+ * Called by drivers that changed the configuration of a device after
+ * it was attached.
+ */
+void
+usb_config_changed(struct usbd_device *dev)
+{
+	struct usb_softc *usbctl = (struct usb_softc *)dev->bus->usbctl;
+
+	usb_scan_devices(usbctl);
+}
+
 void
 usb_needs_reattach(struct usbd_device *dev)
 {
@@ -1092,6 +1513,8 @@ int
 usb_detach(struct device *self, int flags)
 {
 	struct usb_softc *sc = (struct usb_softc *)self;
+	struct usb_client *uc;
+	int addr, s;
 
 	if (sc->sc_bus->root_hub != NULL) {
 		usb_detach_roothub(sc);
@@ -1108,5 +1531,27 @@ usb_detach(struct device *self, int flags)
 		sc->sc_bus->soft = NULL;
 	}
 
+	/* Readers waiting for hotplug events. */
+	sc->sc_bus->dying = 1;
+	s = splusb();
+	if (--sc->sc_refcnt >= 0) {
+		wakeup(&sc->sc_evgen);
+		usb_detach_wait(&sc->sc_dev);
+	}
+	splx(s);
+
+	/* The devices are gone and their transfers with them. */
+	while ((uc = LIST_FIRST(&sc->sc_clients)) != NULL) {
+		LIST_REMOVE(uc, uc_next);
+		usb_free_client(uc);
+	}
+
+	for (addr = 0; addr < USB_MAX_DEVICES; addr++) {
+		if (sc->sc_snap[addr] != NULL) {
+			usb_snap_free(sc->sc_snap[addr]);
+			sc->sc_snap[addr] = NULL;
+		}
+	}
+
 	return (0);
 }
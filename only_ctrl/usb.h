@@ -712,6 +712,20 @@ struct usb_device_ddesc {
 	struct usb_device_descriptor udd_desc;
 };
 
+/*
+ * All descriptors of a device: the full descriptor sets of every
+ * configuration are returned back to back in uad_data.  If uad_size
+ * is too small nothing is copied, the size needed is always returned.
+ */
+struct usb_device_alldesc {
+	u_int8_t	 uad_bus;
+	u_int8_t	 uad_addr;	/* device address */
+	int		 uad_config_index; /* active, -1 if unconfigured */
+	struct usb_device_descriptor uad_ddesc;
+	u_int		 uad_size;
+	u_char		*uad_data;
+};
+
 struct usb_string_desc {
 	int	usd_string_index;
 	int	usd_language_id;
@@ -754,6 +768,37 @@ struct usb_device_info {
 	char		udi_serial[USB_MAX_STRING_LEN];
 };
 
+/* One attached device, as returned by USB_BUS_SNAPSHOT. */
+struct usb_bus_device {
+	struct usb_device_info	ubd_info;
+	struct usb_device_descriptor ubd_ddesc;
+};
+
+struct usb_bus_snapshot {
+	int			 ubs_count;	/* in: room, out: attached */
+	struct usb_bus_device	*ubs_devs;
+};
+
+/*
+ * Hotplug events, read from /dev/usbN by processes that turned them on
+ * with USB_SET_EVENTS.  Each such process reads every event posted
+ * since then once.  ue_gen goes up by one per event, a jump means
+ * events were lost.  USB_GET_GENERATION returns the generation of the
+ * last event.
+ */
+struct usb_event {
+	u_int32_t	ue_gen;
+	u_int8_t	ue_type;
+#define USB_EVENT_ATTACH	1
+#define USB_EVENT_DETACH	2
+#define USB_EVENT_CONFIG	3	/* configuration changed */
+	u_int8_t	ue_bus;
+	u_int8_t	ue_addr;	/* device address */
+	u_int8_t	ue_config;	/* current configuration, 0 if none */
+	u_int16_t	ue_vendorNo;
+	u_int16_t	ue_productNo;
+};
+
 struct usb_ctl_report {
 	int	ucr_report;
 	u_char	ucr_data[1024];	/* filled data size will vary */
@@ -773,6 +818,10 @@ struct usb_device_stats {
 #define USB_DEVICE_GET_FDESC	_IOWR('U', 7, struct usb_device_fdesc)
 #define USB_DEVICE_GET_DDESC	_IOWR('U', 8, struct usb_device_ddesc)
 #define USB_COMPLETED		_IOWR('U', 9, struct usb_request_block)
+#define USB_BUS_SNAPSHOT	_IOWR('U', 10, struct usb_bus_snapshot)
+#define USB_DEVICE_GET_ALLDESC	_IOWR('U', 11, struct usb_device_alldesc)
+#define USB_GET_GENERATION	_IOR ('U', 12, u_int32_t)
+#define USB_SET_EVENTS		_IOW ('U', 13, int)
 
 /* Generic HID device */
 #define USB_GET_REPORT_DESC	_IOR ('U', 21, struct usb_ctl_report_desc)
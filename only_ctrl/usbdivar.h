@@ -248,6 +248,7 @@ int		usbd_detach(struct usbd_device *, struct device *);
 /* Routines from usb.c */
 void		usb_needs_explore(struct usbd_device *, int);
 void		usb_needs_reattach(struct usbd_device *);
+void		usb_config_changed(struct usbd_device *);
 void		usb_schedsoftintr(struct usbd_bus *);
 
 #define	UHUB_UNK_CONFIGURATION	-1
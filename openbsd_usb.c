@@ -440,6 +440,7 @@ obsd_clear_halt(struct libusb_device_handle *handle, unsigned char endpoint)
 
 	usbi_dbg("");
 
+	memset(&req, 0, sizeof(req));
 	req.ucr_addr = handle->dev->device_address;
 	req.ucr_request.bmRequestType = UT_WRITE_ENDPOINT;
 	req.ucr_request.bRequest = UR_CLEAR_FEATURE;
@@ -511,7 +512,10 @@ obsd_submit_transfer(struct usbi_transfer *itransfer)
 			err = LIBUSB_ERROR_NOT_SUPPORTED;
 			break;
 		}
-		err = _sync_gen_transfer(itransfer);
+		if (IS_XFERIN(transfer))
+			err = _sync_bulk_transfer(itransfer);
+		else
+			err = _sync_gen_transfer(itransfer);
 		break;
 	case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
 		err = LIBUSB_ERROR_NOT_SUPPORTED;
@@ -524,8 +528,10 @@ obsd_submit_transfer(struct usbi_transfer *itransfer)
 	if (transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL) {
 		if (dpriv->devname == NULL)
 			usbi_signal_transfer_completion(itransfer);
-	} else if (transfer->type == LIBUSB_TRANSFER_TYPE_BULK) {
-		/* do nothing */
+	} else if (transfer->type == LIBUSB_TRANSFER_TYPE_BULK ||
+	    (transfer->type == LIBUSB_TRANSFER_TYPE_INTERRUPT &&
+	    IS_XFERIN(transfer))) {
+		/* completed through obsd_handle_events() */
 	} else {
 		usbi_signal_transfer_completion(itransfer);
 	}
@@ -558,7 +564,10 @@ obsd_cancel_transfer(struct usbi_transfer *itransfer)
 		err = _cancel_bulk_transfer(itransfer);
 		break;
 	case LIBUSB_TRANSFER_TYPE_INTERRUPT:
-		err = LIBUSB_ERROR_NOT_SUPPORTED;
+		if (IS_XFERIN(transfer))
+			err = _cancel_bulk_transfer(itransfer);
+		else
+			err = LIBUSB_ERROR_NOT_SUPPORTED;
 		break;
 	case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
 		err = LIBUSB_ERROR_NOT_SUPPORTED;
@@ -587,9 +596,11 @@ obsd_handle_events(struct libusb_context *ctx, struct pollfd *fds, nfds_t nfds,
 	struct handle_priv *hpriv = NULL;
 	struct device_priv *dpriv = NULL;
 	struct usbi_transfer *itransfer;
-	struct usb_ctl_request req;
+	struct usb_ctl_request reqs[USB_MAX_REQUESTS], *req;
+	struct usb_ctl_requests ucrs;
 	struct pollfd *pollfd;
-	int i, err = 0;
+	int i, j, err = 0;
+	int r, ret = LIBUSB_SUCCESS;
 	int endpt;
 	int error_code = LIBUSB_TRANSFER_COMPLETED;
 	int fd;
@@ -645,59 +656,63 @@ out:
 			continue;
 		}
 
-		while (1) {
-repeat:
-			if (ioctl(fd, USB_GET_COMPLETED, &req)) {
+		do {
+			memset(&ucrs, 0, sizeof(ucrs));
+			ucrs.ucrs_reqs = reqs;
+			ucrs.ucrs_count = USB_MAX_REQUESTS;
+			if (ioctl(fd, USB_GET_COMPLETIONS, &ucrs)) {
 				err = 0;
 				break;
 			}
-			itransfer = req.ucr_context;
-
-			switch(req.ucr_status) {
-			case USBD_NORMAL_COMPLETION:
-				usbi_mutex_lock(&itransfer->lock);
-				itransfer->transferred += req.ucr_actlen;
-				usbi_dbg("transferred %d", itransfer->transferred);
-				usbi_mutex_unlock(&itransfer->lock);
-
-				error_code = LIBUSB_TRANSFER_COMPLETED;
-				break;
-			case USBD_SHORT_XFER:
-				error_code = LIBUSB_TRANSFER_ERROR;
-				break;
-			case USBD_IN_PROGRESS:
-				goto repeat;
-			/* errors */
-			case USBD_CANCELLED:
-				error_code = LIBUSB_TRANSFER_CANCELLED;
-				break;
-			case USBD_STALLED:
-				error_code = LIBUSB_TRANSFER_STALL;
-				break;
-			default:
-				error_code = LIBUSB_TRANSFER_ERROR;
-				break;
-			}
-			if (error_code == LIBUSB_TRANSFER_CANCELLED) {
-				usbi_dbg("cancelling the transfer");
-				if ((err = usbi_handle_transfer_cancellation(itransfer)))
+			for (j = 0; j < ucrs.ucrs_done; j++) {
+				req = &reqs[j];
+				itransfer = req->ucr_context;
+
+				switch(req->ucr_status) {
+				case USBD_NORMAL_COMPLETION:
+					usbi_mutex_lock(&itransfer->lock);
+					itransfer->transferred +=
+					    req->ucr_actlen;
+					usbi_dbg("transferred %d",
+					    itransfer->transferred);
+					usbi_mutex_unlock(&itransfer->lock);
+
+					error_code = LIBUSB_TRANSFER_COMPLETED;
+					break;
+				case USBD_SHORT_XFER:
+					error_code = LIBUSB_TRANSFER_ERROR;
+					break;
+				/* errors */
+				case USBD_CANCELLED:
+					error_code = LIBUSB_TRANSFER_CANCELLED;
 					break;
-			} else {
-				if ((err = usbi_handle_transfer_completion(itransfer, error_code)))
+				case USBD_STALLED:
+					error_code = LIBUSB_TRANSFER_STALL;
 					break;
+				default:
+					error_code = LIBUSB_TRANSFER_ERROR;
+					break;
+				}
+				if (error_code == LIBUSB_TRANSFER_CANCELLED) {
+					usbi_dbg("cancelling the transfer");
+					r = usbi_handle_transfer_cancellation(
+					    itransfer);
+				} else {
+					r = usbi_handle_transfer_completion(
+					    itransfer, error_code);
+				}
+				/* The rest of the batch is reaped already. */
+				if (r != 0 && ret == LIBUSB_SUCCESS)
+					ret = r;
 			}
-		}
-		if (err) {
-			err = errno;
-			break;
-		}
+		} while (ucrs.ucrs_done == USB_MAX_REQUESTS);
 	}
 	pthread_mutex_unlock(&ctx->open_devs_lock);
 
 	if (err)
 		return _errno_to_libusb(err);
 
-	return (LIBUSB_SUCCESS);
+	return (ret);
 }
 
 int
@@ -812,6 +827,7 @@ _sync_control_transfer(struct usbi_transfer *itransfer)
 	    libusb_le16_to_cpu(setup->wIndex),
 	    libusb_le16_to_cpu(setup->wLength), transfer->timeout);
 
+	memset(&req, 0, sizeof(req));
 	req.ucr_addr = transfer->dev_handle->dev->device_address;
 	req.ucr_request.bmRequestType = setup->bmRequestType;
 	req.ucr_request.bRequest = setup->bRequest;
@@ -877,6 +893,7 @@ _cancel_control_transfer(struct usbi_transfer *itransfer) {
 	if (dpriv->devname == NULL)
 		return (LIBUSB_ERROR_NOT_SUPPORTED);
 
+	memset(&req, 0, sizeof(req));
 	req.ucr_context = itransfer;
 	if (ioctl(dpriv->fd, USB_CANCEL, &req)) {
 		usbi_dbg("transfer not found");
@@ -911,6 +928,7 @@ _cancel_bulk_transfer(struct usbi_transfer *itransfer) {
 	if ((fd = _access_endpoint(transfer)) < 0)
 		return _errno_to_libusb(errno);
 
+	memset(&req, 0, sizeof(req));
 	req.ucr_context = itransfer;
 	if (ioctl(fd, USB_CANCEL, &req)) {
 		usbi_dbg("transfer not found");
@@ -985,6 +1003,7 @@ _sync_bulk_transfer(struct usbi_transfer *itransfer)
 	if ((fd = _access_endpoint(transfer)) < 0)
 		return _errno_to_libusb(errno);
 
+	memset(&req, 0, sizeof(req));
 	req.ucr_timeout = transfer->timeout;
 	req.ucr_flags = 0;
 	if ((transfer->flags & LIBUSB_TRANSFER_SHORT_NOT_OK) == 0)
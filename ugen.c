@@ -40,12 +40,15 @@
 #include <sys/device.h>
 #include <sys/ioctl.h>
 #include <sys/conf.h>
-#include <sys/tty.h>
 #include <sys/file.h>
 #include <sys/selinfo.h>
 #include <sys/vnode.h>
 #include <sys/poll.h>
 #include <sys/rwlock.h>
+#include <sys/atomic.h>
+#include <sys/timeout.h>
+
+#include <uvm/uvm_extern.h>
 
 #include <machine/bus.h>
 
@@ -65,15 +68,19 @@ int	ugendebug = 0;
 #define DPRINTFN(n,x)
 #endif
 
-#define	UGEN_CHUNK	128	/* chunk size for read */
-#define	UGEN_IBSIZE	1020	/* buffer size */
-#define	UGEN_BBSIZE	1024
+#define	UGEN_NIPKTS	64	/* interrupt packets queued, power of 2 */
+#define	UGEN_BBSIZE	1024	/* default bulk read/write transfer size */
+#define	UGEN_BBSIZE_MAX	(64 * 1024)
 
+/* Default isoc ring geometry, see USB_SET_ISOC_GEOMETRY. */
 #define	UGEN_NISOFRAMES	500	/* 0.5 seconds worth */
 #define UGEN_NISOREQS	6	/* number of outstanding xfer requests */
 #define UGEN_NISORFRMS	4	/* number of frames (miliseconds) per req */
 
-struct rwlock q_lock;
+#define UGEN_CTX_HASHSIZE	32	/* buckets of the context hash */
+#define UGEN_CTX_HASH(sce, ctx) \
+	(&(sce)->ctx_hash[((u_long)(ctx) >> 4) & (UGEN_CTX_HASHSIZE - 1)])
+#define UGEN_CQSIZE	256	/* requests in flight or completed, 2^n */
 
 struct ugen_endpoint {
 	struct ugen_softc *sc;
@@ -82,24 +89,106 @@ struct ugen_endpoint {
 	int state;
 #define	UGEN_ASLP	0x02	/* waiting for data */
 #define UGEN_SHORT_OK	0x04	/* short xfers are OK */
+#define UGEN_ASYNC	0x08	/* read path stopped for async requests */
+#define UGEN_BBUSY	0x10	/* bxfer in use */
+#define UGEN_RA		0x20	/* bulk read-ahead running */
+#define UGEN_SETUP	0x40	/* read-ahead or write-behind starting */
+#define UGEN_WB		0x80	/* bulk write-behind running */
+#define UGEN_IRECORDS	0x100	/* interrupt read returns records */
+#define UGEN_IREAD	0x200	/* read(2) copying out packets */
 	struct usbd_pipe *pipeh;
-	struct clist q;
+	u_char *ipkts;		/* interrupt packet ring */
+	int nipkts;
+	int ipktsize;		/* bytes per ring slot */
+	u_int ipkt_head;	/* next slot to fill */
+	u_int ipkt_tail;	/* next slot to read */
+	u_int64_t ipkt_drops;
 	struct selinfo rsel;
-	u_char *ibuf;		/* start of buffer (circular for isoc) */
-	u_char *fill;		/* location for input (isoc) */
-	u_char *limit;		/* end of circular buffer (isoc) */
-	u_char *cur;		/* current read location (isoc) */
+	u_char *ibuf;		/* start of buffer (circular for isoc, ra) */
+	u_char *fill;		/* location for input (isoc, ra) */
+	u_char *limit;		/* end of circular buffer (isoc, ra) */
+	u_char *cur;		/* current read location (isoc, ra) */
 	u_int32_t timeout;
+	struct usbd_xfer *bxfer;	/* cached bulk read/write transfer */
+	int bsize;			/* bulk read/write transfer size */
 	struct isoreq {
 		struct ugen_endpoint *sce;
 		struct usbd_xfer *xfer;
 		void *dmabuf;
-		u_int16_t sizes[UGEN_NISORFRMS];
-	} isoreqs[UGEN_NISOREQS];
+		u_int16_t *sizes;
+	} *isoreqs;		/* isoc read transfers, once started */
+	int nisoreqs;		/* isoc ring geometry */
+	int nisorfrms;
+	int nisoframes;
+	int isize;		/* isoc packet size */
+	struct usbd_xfer **raxfers;	/* bulk read-ahead transfers */
+	int nraxfers;
+	int ra_xfersize;
+	int ra_inflight;
+	u_int64_t ra_overruns;
+	struct usbd_xfer **wbxfers;	/* bulk write-behind transfers */
+	int nwbxfers;
+	int wb_xfersize;
+	int wb_first;		/* oldest transfer in flight */
+	int wb_inflight;
+	int wb_error;		/* first deferred error */
 	TAILQ_HEAD(, usb_ctl_request) submit_queue;
-	TAILQ_HEAD(, usb_ctl_request) complete_queue;
+	struct usb_ctl_request **cq;	/* completion queue, SPSC ring */
+	volatile u_int cq_head;	/* only written by ugen_async_callback */
+	volatile u_int cq_tail;	/* only written with cq_lock held */
+	u_int cq_reserved;	/* slots owned by requests, at splusb */
+	struct rwlock cq_lock;	/* serializes reapers */
+	struct ugen_endpoint *asce;	/* IN side, owns the pool and ring */
+	int reap_out;		/* IN side: reap the OUT side first */
+	int nunreported;	/* completions since the last wakeup */
+	int coalesce_count;	/* wake after this many completions */
+	int coalesce_usec;	/* or this long after the first one */
+	struct timeout wake_to;
+	struct usb_endpoint_stats stats;	/* async requests */
+	LIST_HEAD(, usb_ctl_request) ctx_hash[UGEN_CTX_HASHSIZE];
+	struct rwlock q_lock;	/* protects submit queue and hash */
+	struct usb_cring *cring;	/* mmap'ed completion ring */
+	size_t cring_len;
+	u_int32_t cring_head;	/* never read back from the mapping */
+	u_int32_t cring_size;
+	u_int32_t cring_slotsize;
+	u_int32_t cring_dataoff;
+	int cring_mapped;		/* mmap'ed, kept until detach */
+	struct usb_cring *cring_kept;	/* mapped ring of an earlier open */
+	TAILQ_HEAD(, usb_ctl_request) cring_queue; /* posted, to be freed */
+	struct usb_ctl_request *pool;	/* preallocated requests */
+	int pool_count;
+	int pool_maxlen;
+	int pool_flags;
+	int pool_nfree;
+	int pool_mapped;	/* has been mmap'ed, freed on detach */
+	TAILQ_HEAD(, usb_ctl_request) pool_free;
+	struct rwlock pool_lock;	/* protects the pool */
+	u_int64_t pool_hits;
+	u_int64_t pool_misses;
 };
 
+#define UGEN_POOLED(sce, req) \
+	((sce)->pool != NULL && (req) >= (sce)->pool && \
+	 (req) < (sce)->pool + (sce)->pool_count)
+
+#define UGEN_IPKT(sce, i) ((struct usb_intr_packet *) \
+	((sce)->ipkts + ((i) & ((sce)->nipkts - 1)) * (sce)->ipktsize))
+
+/* Bytes in the circular buffer of an isoc or bulk ring. */
+#define UGEN_RING_USED(sce) \
+	((sce)->fill >= (sce)->cur ? (sce)->fill - (sce)->cur : \
+	 ((sce)->limit - (sce)->ibuf) - ((sce)->cur - (sce)->fill))
+#define UGEN_RING_SPACE(sce) \
+	((sce)->limit - (sce)->ibuf - 1 - UGEN_RING_USED(sce))
+
+#define UGEN_CRING_PENDING(sce) \
+	((sce)->asce->cring != NULL && \
+	 (sce)->asce->cring_head != (sce)->asce->cring->uc_tail)
+
+/* The OUT side of an endpoint, sides are next to each other. */
+#define UGEN_OSCE(sce)	((sce)->asce - (IN - OUT))
+
 struct ugen_softc {
 	struct device sc_dev;		/* base device */
 	struct usbd_device *sc_udev;
@@ -114,17 +203,86 @@ struct ugen_softc {
 };
 
 void ugen_async_callback(struct usbd_xfer *, void *, usbd_status);
-int ugen_submit_ctrl(struct ugen_softc *, struct
-    usb_ctl_request *, struct proc *p);
-int ugen_submit_bulk(struct ugen_softc *, struct
-    usb_ctl_request *, struct proc *p);
+void ugen_async_wakeup(struct ugen_endpoint *);
+void ugen_async_account(struct ugen_endpoint *, struct usb_ctl_request *,
+    usbd_status);
+int ugen_cq_init(struct ugen_endpoint *);
+void ugen_cq_put(struct ugen_endpoint *, struct usb_ctl_request *);
+struct usb_ctl_request *ugen_cq_get(struct ugen_endpoint *);
+u_int ugen_cq_pending(struct ugen_endpoint *);
+u_int ugen_async_pending(struct ugen_endpoint *);
+int ugen_cq_reap(struct ugen_endpoint *, struct usb_ctl_request **, int);
+int ugen_reap(struct ugen_softc *, int, struct usb_ctl_request **, int);
+struct ugen_endpoint *ugen_async_sce(struct ugen_softc *, int,
+    struct usb_ctl_request *);
+void ugen_async_drain(struct ugen_endpoint *, int);
+void ugen_get_stats(struct ugen_softc *, int, struct usb_endpoint_stats *);
+void ugen_async_timeout(void *);
+int ugen_set_coalesce(struct ugen_endpoint *, struct usb_async_coalesce *);
+int ugen_cring_post(struct ugen_endpoint *, struct usb_ctl_request *,
+    usbd_status);
+void ugen_cring_reclaim(struct ugen_endpoint *);
+int ugen_cring_setup(struct ugen_softc *, int, struct usb_cring_setup *);
+int ugen_alloc_request(struct ugen_softc *, struct ugen_endpoint *,
+    struct usb_ctl_request *, int, struct usb_ctl_request **, void **);
+int ugen_alloc_slot(struct ugen_endpoint *, struct usb_ctl_request *, int,
+    struct usb_ctl_request **);
+void ugen_put_request(struct ugen_endpoint *, struct usb_ctl_request *);
+int ugen_pool_setup(struct ugen_softc *, struct ugen_endpoint *,
+    struct usb_pool *);
+void ugen_pool_destroy(struct ugen_endpoint *);
+int ugen_prepare_ctrl(struct ugen_softc *, struct
+    usb_ctl_request *, struct usb_ctl_request **, struct proc *p);
+int ugen_copyin_iov(struct usb_ctl_request *, struct iovec **);
+void ugen_request_uio(struct usb_ctl_request *, struct uio *, struct iovec *,
+    int, struct proc *);
+int ugen_prepare_bulk(struct ugen_softc *, struct
+    usb_ctl_request *, struct usb_ctl_request **, struct proc *p);
+int ugen_prepare_intr(struct ugen_softc *, struct usb_ctl_request *,
+    struct usb_ctl_request **, struct proc *);
+void ugen_set_async(struct ugen_endpoint *);
+int ugen_prepare_isoc(struct ugen_softc *, struct usb_ctl_request *,
+    struct usb_ctl_request **, struct proc *);
+int ugen_prepare_request(struct ugen_softc *, int, struct usb_ctl_request *,
+    struct usb_ctl_request **, struct proc *);
+int ugen_start_request(struct ugen_endpoint *, struct usb_ctl_request *);
+void ugen_abort_requests(struct ugen_endpoint *, int);
 int ugen_complete_ctrl(struct usb_ctl_request *, struct proc
     *p);
 int ugen_complete_bulk(struct usb_ctl_request *, struct proc
     *p);
+int ugen_complete_isoc(struct usb_ctl_request *, struct proc *);
+int ugen_finish_request(struct ugen_softc *, int, struct usb_ctl_request *,
+    struct proc *);
+void ugen_export_request(struct usb_ctl_request *, struct usb_ctl_request *);
+
+struct usbd_xfer *ugen_get_bxfer(struct ugen_softc *, struct ugen_endpoint *,
+    int);
+int ugen_bulk_xfersize(struct ugen_endpoint *, struct uio *);
+void ugen_put_bxfer(struct ugen_endpoint *, struct usbd_xfer *);
+int ugen_set_bsize(struct ugen_softc *, int, int);
+
+int ugen_bulkra_start(struct ugen_softc *, struct ugen_endpoint *,
+    struct usb_bulk_ra *);
+void ugen_bulkra_stop(struct ugen_endpoint *);
+int ugen_read_ring(struct ugen_softc *, struct ugen_endpoint *, struct uio *,
+    int);
+int ugen_isoc_start(struct ugen_softc *, struct ugen_endpoint *);
+int ugen_intr_ring(struct ugen_endpoint *, struct usb_intr_ring *);
+void ugen_intr_ring_status(struct ugen_endpoint *, struct usb_intr_ring *);
+int ugen_isoc_geometry(struct ugen_endpoint *, struct usb_isoc_geometry *);
+int ugen_bulkwb_start(struct ugen_softc *, struct ugen_endpoint *,
+    struct usb_bulk_wb *);
+void ugen_bulkwb_kick(struct ugen_endpoint *);
+int ugen_bulkwb_drain(struct ugen_softc *, struct ugen_endpoint *);
+void ugen_bulkwb_stop(struct ugen_endpoint *);
+int ugen_write_ring(struct ugen_softc *, struct ugen_endpoint *, struct uio *,
+    int);
 
 void ugenintr(struct usbd_xfer *xfer, void *addr, usbd_status status);
 void ugen_isoc_rintr(struct usbd_xfer *xfer, void *addr, usbd_status status);
+void ugen_bulkra_intr(struct usbd_xfer *xfer, void *addr, usbd_status status);
+void ugen_bulkwb_intr(struct usbd_xfer *xfer, void *addr, usbd_status status);
 int ugen_do_read(struct ugen_softc *, int, struct uio *, int);
 int ugen_do_write(struct ugen_softc *, int, struct uio *, int);
 int ugen_do_ioctl(struct ugen_softc *, int, u_long, caddr_t, int,
@@ -156,10 +314,459 @@ void ugen_async_callback(struct usbd_xfer *xfer, void *priv, usbd_status s) {
 
 	if (s == USBD_CANCELLED)
 		req->ucr_status = USBD_CANCELLED;
+	ugen_async_account(sce, req, s);
 
 	TAILQ_REMOVE(&sce->submit_queue, req, entries);
-	TAILQ_INSERT_TAIL(&sce->complete_queue, req, entries);
-	selwakeup(&sce->rsel);
+	/*
+	 * Isoc frame lengths do not fit in a ring entry.  A request that
+	 * went to the ring gives its complete queue slot back at once.
+	 */
+	if (sce->asce->cring != NULL && req->frlengths == NULL &&
+	    ugen_cring_post(sce->asce, req, s)) {
+		TAILQ_INSERT_TAIL(&sce->cring_queue, req, entries);
+		sce->cq_reserved--;
+	} else
+		ugen_cq_put(sce, req);
+	/*
+	 * Completions of either side are readable on the node, which is
+	 * the IN side unless the endpoint is write-only; the OUT side
+	 * is also woken for writers.
+	 */
+	if (sce != sce->asce && sce->asce->edesc != NULL)
+		ugen_async_wakeup(sce->asce);
+	ugen_async_wakeup(sce);
+}
+
+/*
+ * The completion queue is a single-producer single-consumer ring.
+ * ugen_async_callback is the only producer; reapers take cq_lock,
+ * which is never taken from interrupt context, so that there is only
+ * one consumer at a time.  Taking entries off the ring does not lock
+ * out the producer, but the reaped requests still leave the context
+ * hash under q_lock at splusb.  A slot is reserved under q_lock when a
+ * request is started and given back there once the request has been
+ * reaped, so the producer can never overrun the consumer and does not
+ * look at cq_tail at all.
+ */
+int
+ugen_cq_init(struct ugen_endpoint *sce)
+{
+	struct usb_ctl_request **cq;
+
+	if (sce->cq != NULL)
+		return (0);
+	cq = mallocarray(UGEN_CQSIZE, sizeof(*cq), M_USBDEV, M_WAITOK);
+	rw_enter_write(&sce->cq_lock);
+	if (sce->cq == NULL) {
+		sce->cq_head = sce->cq_tail = 0;
+		sce->cq_reserved = 0;
+		sce->cq = cq;
+		cq = NULL;
+	}
+	rw_exit_write(&sce->cq_lock);
+	if (cq != NULL)
+		free(cq, M_USBDEV, UGEN_CQSIZE * sizeof(*cq));
+	return (0);
+}
+
+void
+ugen_cq_put(struct ugen_endpoint *sce, struct usb_ctl_request *req)
+{
+	u_int head = sce->cq_head;
+
+	sce->cq[head & (UGEN_CQSIZE - 1)] = req;
+	membar_producer();
+	sce->cq_head = head + 1;
+}
+
+/*
+ * Take the oldest completion off the ring.  Must be called with
+ * cq_lock held.
+ */
+struct usb_ctl_request *
+ugen_cq_get(struct ugen_endpoint *sce)
+{
+	struct usb_ctl_request *req;
+	u_int tail = sce->cq_tail;
+
+	if (sce->cq == NULL || tail == sce->cq_head)
+		return (NULL);
+	membar_consumer();
+	req = sce->cq[tail & (UGEN_CQSIZE - 1)];
+	sce->cq_tail = tail + 1;
+	return (req);
+}
+
+/*
+ * Number of completions waiting.  cq_tail is read first: it never
+ * passes cq_head, so the difference cannot go negative.
+ */
+u_int
+ugen_cq_pending(struct ugen_endpoint *sce)
+{
+	u_int tail = sce->cq_tail;
+
+	membar_consumer();
+	return (sce->cq_head - tail);
+}
+
+/*
+ * Completions waiting on an endpoint: on both sides and in the ring.
+ * OUT completions count as readable, so that a consumer that polls the
+ * node for POLLIN only also learns about its writes.
+ */
+u_int
+ugen_async_pending(struct ugen_endpoint *sce)
+{
+	struct ugen_endpoint *isce = sce->asce, *osce = UGEN_OSCE(sce);
+	u_int n;
+
+	n = ugen_cq_pending(isce) + ugen_cq_pending(osce);
+	if (isce->cring != NULL)
+		n += isce->cring_head - isce->cring->uc_tail;
+	return (n);
+}
+
+/*
+ * Reap up to count completions.  The requests are taken out of the
+ * context hash and their ring slots are given back, the caller has
+ * to release them.
+ */
+int
+ugen_cq_reap(struct ugen_endpoint *sce, struct usb_ctl_request **kreqs,
+    int count)
+{
+	int i, n, s;
+
+	rw_enter_write(&sce->cq_lock);
+	for (n = 0; n < count; n++)
+		if ((kreqs[n] = ugen_cq_get(sce)) == NULL)
+			break;
+	rw_exit_write(&sce->cq_lock);
+	if (n == 0)
+		return (0);
+
+	s = splusb();
+	rw_enter_write(&sce->q_lock);
+	for (i = 0; i < n; i++)
+		LIST_REMOVE(kreqs[i], hash_entries);
+	sce->cq_reserved -= n;
+	rw_exit_write(&sce->q_lock);
+	splx(s);
+	return (n);
+}
+
+/*
+ * Reap up to count completions from both sides of an endpoint.  The
+ * side that goes first alternates, so that a busy direction cannot
+ * starve the other one.
+ */
+int
+ugen_reap(struct ugen_softc *sc, int endpt, struct usb_ctl_request **kreqs,
+    int count)
+{
+	struct ugen_endpoint *first, *second;
+	int n;
+
+	first = &sc->sc_endpoints[endpt][IN];
+	second = &sc->sc_endpoints[endpt][OUT];
+	if (first->reap_out) {
+		first = second;
+		second = &sc->sc_endpoints[endpt][IN];
+	}
+	sc->sc_endpoints[endpt][IN].reap_out ^= 1;
+	n = ugen_cq_reap(first, kreqs, count);
+	if (n < count)
+		n += ugen_cq_reap(second, kreqs + n, count - n);
+	return (n);
+}
+
+/*
+ * Pick the side of an endpoint an async request is queued on.  All
+ * control requests go through the IN side.  On other endpoints
+ * ucr_read selects the side, unless the endpoint only has the other.
+ */
+struct ugen_endpoint *
+ugen_async_sce(struct ugen_softc *sc, int endpt, struct usb_ctl_request *req)
+{
+	int dir = req->ucr_read ? IN : OUT;
+
+	if (endpt == USB_CONTROL_ENDPOINT)
+		return (&sc->sc_endpoints[endpt][IN]);
+	if (sc->sc_endpoints[endpt][dir].edesc == NULL)
+		dir = dir == IN ? OUT : IN;
+	return (&sc->sc_endpoints[endpt][dir]);
+}
+
+/*
+ * Count a completion in the endpoint statistics.
+ */
+void
+ugen_async_account(struct ugen_endpoint *sce, struct usb_ctl_request *req,
+    usbd_status s)
+{
+	struct usb_endpoint_stats *st = &sce->stats;
+	struct usbd_xfer *xfer = req->xfer;
+	struct timespec now;
+	u_int64_t usec;
+	int i;
+
+	st->ues_completed++;
+	if (s == USBD_CANCELLED)
+		st->ues_cancelled++;
+	else if (xfer->status != USBD_NORMAL_COMPLETION)
+		st->ues_errors[min(xfer->status, USB_STATS_NSTATUS - 1)]++;
+	else if (req->ucr_read)
+		st->ues_bytes_in += xfer->actlen;
+	else
+		st->ues_bytes_out += xfer->actlen;
+
+	nanouptime(&now);
+	timespecsub(&now, &req->start, &now);
+	usec = (u_int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	for (i = 0; i < USB_STATS_NLATENCY - 1 && usec >= (1ULL << i); i++)
+		;
+	st->ues_latency[i]++;
+}
+
+/*
+ * Sum up the statistics of both sides of an endpoint.
+ */
+void
+ugen_get_stats(struct ugen_softc *sc, int endpt, struct usb_endpoint_stats *st)
+{
+	struct ugen_endpoint *sce;
+	struct usb_endpoint_stats *es;
+	int dir, i, s;
+
+	memset(st, 0, sizeof(*st));
+	s = splusb();
+	for (dir = OUT; dir <= IN; dir++) {
+		sce = &sc->sc_endpoints[endpt][dir];
+		es = &sce->stats;
+		st->ues_submitted += es->ues_submitted;
+		st->ues_completed += es->ues_completed;
+		st->ues_cancelled += es->ues_cancelled;
+		for (i = 0; i < USB_STATS_NSTATUS; i++)
+			st->ues_errors[i] += es->ues_errors[i];
+		st->ues_bytes_in += es->ues_bytes_in;
+		st->ues_bytes_out += es->ues_bytes_out;
+		for (i = 0; i < USB_STATS_NLATENCY; i++)
+			st->ues_latency[i] += es->ues_latency[i];
+		st->ues_complete_depth += ugen_cq_pending(sce);
+	}
+	sce = &sc->sc_endpoints[endpt][IN];
+	if (sce->cring != NULL)
+		st->ues_complete_depth +=
+		    sce->cring_head - sce->cring->uc_tail;
+	st->ues_submit_depth = st->ues_submitted - st->ues_completed;
+	splx(s);
+}
+
+/*
+ * Tell pollers about a completion.  With coalescing set up the wakeup
+ * is held back until coalesce_count completions are queued or
+ * coalesce_usec have passed since the first one that was held back.
+ */
+void
+ugen_async_wakeup(struct ugen_endpoint *sce)
+{
+	sce->nunreported++;
+	if (sce->coalesce_count <= 1 ||
+	    sce->nunreported >= sce->coalesce_count) {
+		timeout_del(&sce->wake_to);
+		sce->nunreported = 0;
+		selwakeup(&sce->rsel);
+	} else if (sce->nunreported == 1)
+		timeout_add_usec(&sce->wake_to, sce->coalesce_usec);
+}
+
+void
+ugen_async_timeout(void *arg)
+{
+	struct ugen_endpoint *sce = arg;
+	int s;
+
+	s = splusb();
+	if (sce->nunreported > 0) {
+		sce->nunreported = 0;
+		selwakeup(&sce->rsel);
+	}
+	splx(s);
+}
+
+int
+ugen_set_coalesce(struct ugen_endpoint *sce, struct usb_async_coalesce *uac)
+{
+	int s;
+
+	if (uac->uac_count < 0 || uac->uac_count > USB_COALESCE_MAXCOUNT ||
+	    uac->uac_usec < 0 || uac->uac_usec > USB_COALESCE_MAXUSEC)
+		return (EINVAL);
+	/* Without a time limit the last completions could go unnoticed. */
+	if (uac->uac_count > 1 && uac->uac_usec == 0)
+		return (EINVAL);
+
+	s = splusb();
+	sce->coalesce_count = uac->uac_count;
+	sce->coalesce_usec = uac->uac_usec;
+	/* Report anything held back under the old setting. */
+	if (sce->nunreported > 0) {
+		timeout_del(&sce->wake_to);
+		sce->nunreported = 0;
+		selwakeup(&sce->rsel);
+	}
+	splx(s);
+	return (0);
+}
+
+/*
+ * Post a completion to the endpoint's shared ring.  Returns 0 if the
+ * ring is full or the data does not fit in a slot, in which case the
+ * request has to go through the complete queue instead.
+ *
+ * The header is writable by userland, so only uc_tail is read from
+ * it; a bogus tail can make the ring look full, nothing else.
+ */
+int
+ugen_cring_post(struct ugen_endpoint *sce, struct usb_ctl_request *req,
+    usbd_status s)
+{
+	struct usb_cring *r = sce->cring;
+	struct usb_cring_entry *e;
+	struct usbd_xfer *xfer = req->xfer;
+	u_int32_t head = sce->cring_head, slot, off;
+	int copy;
+
+	copy = req->ucr_read && !(req->ucr_flags & USBD_ZERO_COPY);
+	if (head - r->uc_tail >= sce->cring_size ||
+	    (copy && xfer->actlen > sce->cring_slotsize)) {
+		r->uc_overflow++;
+		return (0);
+	}
+
+	slot = head & (sce->cring_size - 1);
+	e = (struct usb_cring_entry *)(r + 1) + slot;
+	off = sce->cring_dataoff + slot * sce->cring_slotsize;
+	e->uce_context = req->ucr_context;
+	e->uce_status = (s == USBD_CANCELLED) ? USBD_CANCELLED : xfer->status;
+	e->uce_actlen = xfer->actlen;
+	if (req->ucr_flags & USBD_ZERO_COPY)
+		e->uce_offset = USB_POOL_MAPOFF +
+		    (req - sce->pool) * sce->pool_maxlen;
+	else
+		e->uce_offset = off;
+	if (e->uce_status == USBD_NORMAL_COMPLETION && copy &&
+	    xfer->actlen != 0)
+		memcpy((char *)r + off, KERNADDR(&xfer->dmabuf, 0),
+		    xfer->actlen);
+	membar_producer();
+	r->uc_head = sce->cring_head = head + 1;
+	return (1);
+}
+
+/*
+ * Free the requests whose completion has been posted to the ring.
+ */
+void
+ugen_cring_reclaim(struct ugen_endpoint *sce)
+{
+	struct usb_ctl_request *req;
+	int s;
+
+	s = splusb();
+	rw_enter_write(&sce->q_lock);
+	while ((req = TAILQ_FIRST(&sce->cring_queue))) {
+		TAILQ_REMOVE(&sce->cring_queue, req, entries);
+		LIST_REMOVE(req, hash_entries);
+		ugen_put_request(sce, req);
+	}
+	rw_exit_write(&sce->q_lock);
+	splx(s);
+}
+
+/*
+ * Replace the completion ring of an endpoint.  Only allowed while no
+ * request is in flight on either side.
+ *
+ * Mappings of the ring are not tracked and can outlive the file, so
+ * once it has been mapped the ring is only freed on detach: it can
+ * only be set up again with the same geometry, which resets it.
+ */
+int
+ugen_cring_setup(struct ugen_softc *sc, int endpt,
+    struct usb_cring_setup *ucs)
+{
+	struct ugen_endpoint *sce = &sc->sc_endpoints[endpt][IN];
+	struct ugen_endpoint *sceo = &sc->sc_endpoints[endpt][OUT];
+	struct usb_cring *r = NULL, *or;
+	size_t len = 0, olen = 0, hdr = 0;
+	int s, reuse;
+
+	reuse = sce->cring_mapped;
+	if (reuse && (ucs->ucs_size != sce->cring_size ||
+	    ucs->ucs_slotsize != sce->cring_slotsize))
+		return (EBUSY);
+	if (!reuse && ucs->ucs_size != 0) {
+		if (ucs->ucs_size > USB_CRING_MAXSIZE ||
+		    (ucs->ucs_size & (ucs->ucs_size - 1)) != 0 ||
+		    ucs->ucs_slotsize > USB_CRING_MAXMAP / ucs->ucs_size)
+			return (EINVAL);
+		hdr = sizeof(*r) +
+		    ucs->ucs_size * sizeof(struct usb_cring_entry);
+		hdr = roundup(hdr, sizeof(u_int64_t));
+		len = round_page(hdr + ucs->ucs_size * ucs->ucs_slotsize);
+		r = km_alloc(len, &kv_any, &kp_zero, &kd_waitok);
+		if (r == NULL)
+			return (ENOMEM);
+		r->uc_size = ucs->ucs_size;
+		r->uc_slotsize = ucs->ucs_slotsize;
+		r->uc_dataoff = hdr;
+	}
+
+	s = splusb();
+	rw_enter_write(&sce->q_lock);
+	if (!TAILQ_EMPTY(&sce->submit_queue) ||
+	    !TAILQ_EMPTY(&sceo->submit_queue) ||
+	    (!reuse && sce->cring_mapped)) {
+		rw_exit_write(&sce->q_lock);
+		splx(s);
+		if (r != NULL)
+			km_free(r, len, &kv_any, &kp_zero);
+		return (EBUSY);
+	}
+	if (reuse) {
+		if (sce->cring == NULL) {
+			sce->cring = sce->cring_kept;
+			sce->cring_kept = NULL;
+		}
+		r = sce->cring;
+		memset(r, 0, sce->cring_dataoff);
+		r->uc_size = sce->cring_size;
+		r->uc_slotsize = sce->cring_slotsize;
+		r->uc_dataoff = sce->cring_dataoff;
+		sce->cring_head = 0;
+		len = sce->cring_len;
+		or = NULL;
+	} else {
+		or = sce->cring;
+		olen = sce->cring_len;
+		sce->cring = r;
+		sce->cring_len = len;
+		sce->cring_head = 0;
+		sce->cring_size = ucs->ucs_size;
+		sce->cring_slotsize = ucs->ucs_slotsize;
+		sce->cring_dataoff = hdr;
+	}
+	rw_exit_write(&sce->q_lock);
+	splx(s);
+
+	if (or != NULL)
+		km_free(or, olen, &kv_any, &kp_zero);
+	ugen_cring_reclaim(sce);
+	ugen_cring_reclaim(sceo);
+	ucs->ucs_mapsize = len;
+	return (0);
 }
 
 int
@@ -179,11 +786,22 @@ ugen_attach(struct device *parent, struct device *self, void *aux)
 	struct ugen_softc *sc = (struct ugen_softc *)self;
 	struct usb_attach_arg *uaa = aux;
 	struct usbd_device *udev;
+	struct ugen_endpoint *sce;
 	usbd_status err;
-	int conf;
+	int conf, endptno, dir;
 
 	sc->sc_udev = udev = uaa->device;
 
+	for (endptno = 0; endptno < USB_MAX_ENDPOINTS; endptno++)
+		for (dir = OUT; dir <= IN; dir++) {
+			sce = &sc->sc_endpoints[endptno][dir];
+			rw_init(&sce->q_lock, "ugenq");
+			rw_init(&sce->cq_lock, "ugencq");
+			rw_init(&sce->pool_lock, "ugenpool");
+			sce->asce = &sc->sc_endpoints[endptno][IN];
+			timeout_set(&sce->wake_to, ugen_async_timeout, sce);
+		}
+
 	if (usbd_get_devcnt(udev) > 0)
 		sc->sc_secondary = 1;
 
@@ -250,7 +868,20 @@ ugen_set_config(struct ugen_softc *sc, int configno)
 		}
 	}
 
-	memset(sc->sc_endpoints, 0, sizeof sc->sc_endpoints);
+	/*
+	 * Forget the endpoints of the old configuration.  The control
+	 * endpoint may be open with async requests in flight and is left
+	 * alone, the locks and timeouts are set up once in ugen_attach.
+	 */
+	for (endptno = 1; endptno < USB_MAX_ENDPOINTS; endptno++)
+		for (dir = OUT; dir <= IN; dir++) {
+			sce = &sc->sc_endpoints[endptno][dir];
+			sce->sc = NULL;
+			sce->edesc = NULL;
+			sce->iface = NULL;
+			sce->state = 0;
+			sce->timeout = 0;
+		}
 	for (ifaceno = 0; ifaceno < cdesc->bNumInterface; ifaceno++) {
 		DPRINTFN(1,("ugen_set_config: ifaceno %d\n", ifaceno));
 		if (usbd_iface_claimed(sc->sc_udev, ifaceno)) {
@@ -289,9 +920,7 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 	struct ugen_endpoint *sce;
 	int dir, isize;
 	usbd_status err;
-	struct usbd_xfer *xfer;
-	void *buf;
-	int i, j;
+	int i;
 
 	if (unit >= ugen_cd.cd_ndevs)
 		return (ENXIO);
@@ -308,11 +937,18 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 	if (sc->sc_is_open[endpt])
 		return (EBUSY);
 
-	sce = &sc->sc_endpoints[endpt][IN];
-	TAILQ_INIT(&sce->submit_queue);
-	TAILQ_INIT(&sce->complete_queue);
-
-	rw_init(&q_lock, "q_lock");
+	/* Async requests are queued per direction. */
+	for (dir = OUT; dir <= IN; dir++) {
+		sce = &sc->sc_endpoints[endpt][dir];
+		TAILQ_INIT(&sce->submit_queue);
+		sce->cq_head = sce->cq_tail = 0;
+		sce->cq_reserved = 0;
+		sce->reap_out = 0;
+		memset(&sce->stats, 0, sizeof(sce->stats));
+		TAILQ_INIT(&sce->cring_queue);
+		for (i = 0; i < UGEN_CTX_HASHSIZE; i++)
+			LIST_INIT(&sce->ctx_hash[i]);
+	}
 
 	if (endpt == USB_CONTROL_ENDPOINT) {
 		sc->sc_is_open[USB_CONTROL_ENDPOINT] = 1;
@@ -336,6 +972,7 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 		sce = &sc->sc_endpoints[endpt][dir];
 		sce->state = 0;
 		sce->timeout = USBD_NO_TIMEOUT;
+		sce->bsize = UGEN_BBSIZE;
 		DPRINTFN(5, ("ugenopen: sc=%p, endpt=%d, dir=%d, sce=%p\n",
 			     sc, endpt, dir, sce));
 		edesc = sce->edesc;
@@ -348,13 +985,19 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 					return (EIO);
 				break;
 			}
-			isize = UGETW(edesc->wMaxPacketSize);
+			isize = UE_GET_SIZE(UGETW(edesc->wMaxPacketSize)) *
+			    (UE_GET_TRANS(UGETW(edesc->wMaxPacketSize)) + 1);
 			if (isize == 0)	/* shouldn't happen */
 				return (EINVAL);
 			sce->ibuf = malloc(isize, M_USBDEV, M_WAITOK);
 			DPRINTFN(5, ("ugenopen: intr endpt=%d,isize=%d\n",
 				     endpt, isize));
-			clalloc(&sce->q, UGEN_IBSIZE, 0);
+			sce->ipktsize = USB_INTR_RECORD_SIZE(isize);
+			sce->nipkts = UGEN_NIPKTS;
+			sce->ipkts = mallocarray(sce->nipkts, sce->ipktsize,
+			    M_USBDEV, M_WAITOK | M_ZERO);
+			sce->ipkt_head = sce->ipkt_tail = 0;
+			sce->ipkt_drops = 0;
 			err = usbd_open_pipe_intr(sce->iface,
 				  edesc->bEndpointAddress,
 				  USBD_SHORT_XFER_OK, &sce->pipeh, sce,
@@ -362,7 +1005,10 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 				  USBD_DEFAULT_INTERVAL);
 			if (err) {
 				free(sce->ibuf, M_USBDEV, 0);
-				clfree(&sce->q);
+				free(sce->ipkts, M_USBDEV,
+				    sce->nipkts * sce->ipktsize);
+				sce->ibuf = NULL;
+				sce->ipkts = NULL;
 				return (EIO);
 			}
 			DPRINTFN(5, ("ugenopen: interrupt open done\n"));
@@ -374,50 +1020,32 @@ ugenopen(dev_t dev, int flag, int mode, struct proc *p)
 				return (EIO);
 			break;
 		case UE_ISOCHRONOUS:
-			if (dir == OUT)
-				return (EINVAL);
-			isize = UGETW(edesc->wMaxPacketSize);
+			if (dir == OUT) {
+				/* Only usable through async requests. */
+				err = usbd_open_pipe(sce->iface,
+				    edesc->bEndpointAddress, 0, &sce->pipeh);
+				if (err)
+					return (EIO);
+				break;
+			}
+			/* High-bandwidth endpoints send several per frame. */
+			isize = UE_GET_SIZE(UGETW(edesc->wMaxPacketSize)) *
+			    (UE_GET_TRANS(UGETW(edesc->wMaxPacketSize)) + 1);
 			if (isize == 0)	/* shouldn't happen */
 				return (EINVAL);
-			sce->ibuf = mallocarray(isize, UGEN_NISOFRAMES,
-				M_USBDEV, M_WAITOK);
-			sce->cur = sce->fill = sce->ibuf;
-			sce->limit = sce->ibuf + isize * UGEN_NISOFRAMES;
+			sce->isize = isize;
+			sce->nisoframes = UGEN_NISOFRAMES;
+			sce->nisoreqs = UGEN_NISOREQS;
+			sce->nisorfrms = UGEN_NISORFRMS;
 			DPRINTFN(5, ("ugenopen: isoc endpt=%d, isize=%d\n",
 				     endpt, isize));
 			err = usbd_open_pipe(sce->iface,
 				  edesc->bEndpointAddress, 0, &sce->pipeh);
-			if (err) {
-				free(sce->ibuf, M_USBDEV, 0);
+			if (err)
 				return (EIO);
-			}
-			for(i = 0; i < UGEN_NISOREQS; ++i) {
-				sce->isoreqs[i].sce = sce;
-				xfer = usbd_alloc_xfer(sc->sc_udev);
-				if (xfer == 0)
-					goto bad;
-				sce->isoreqs[i].xfer = xfer;
-				buf = usbd_alloc_buffer
-					(xfer, isize * UGEN_NISORFRMS);
-				if (buf == 0) {
-					i++;
-					goto bad;
-				}
-				sce->isoreqs[i].dmabuf = buf;
-				for(j = 0; j < UGEN_NISORFRMS; ++j)
-					sce->isoreqs[i].sizes[j] = isize;
-				usbd_setup_isoc_xfer(xfer, sce->pipeh,
-				    &sce->isoreqs[i], sce->isoreqs[i].sizes,
-				    UGEN_NISORFRMS, USBD_NO_COPY |
-				    USBD_SHORT_XFER_OK, ugen_isoc_rintr);
-				(void)usbd_transfer(xfer);
-			}
+			/* The ring is started by the first read or poll. */
 			DPRINTFN(5, ("ugenopen: isoc open done\n"));
 			break;
-		bad:
-			while (--i >= 0) /* implicit buffer free */
-				usbd_free_xfer(sce->isoreqs[i].xfer);
-			return (ENOMEM);
 		case UE_CONTROL:
 			sce->timeout = USBD_DEFAULT_TIMEOUT;
 			return (EINVAL);
@@ -448,12 +1076,51 @@ ugenclose(dev_t dev, int flag, int mode, struct proc *p)
 	return (error);
 }
 
+/*
+ * Abort the async requests of one side of an endpoint and free them,
+ * along with the completions that were not reaped.
+ */
+void
+ugen_async_drain(struct ugen_endpoint *sce, int endpt)
+{
+	struct usb_ctl_request *req, **cq;
+	int s;
+
+	s = splusb();
+	/* Abort what is still in flight, it ends up on the completion queue. */
+	ugen_abort_requests(sce, endpt);
+	rw_enter_write(&sce->cq_lock);
+	rw_enter_write(&sce->q_lock);
+	while ((req = ugen_cq_get(sce)) != NULL) {
+		LIST_REMOVE(req, hash_entries);
+		ugen_put_request(sce, req);
+	}
+	cq = sce->cq;
+	sce->cq = NULL;
+	sce->cq_head = sce->cq_tail = 0;
+	sce->cq_reserved = 0;
+	timeout_del(&sce->wake_to);
+	sce->nunreported = 0;
+	sce->coalesce_count = 0;
+	sce->coalesce_usec = 0;
+	while ((req = TAILQ_FIRST(&sce->cring_queue))) {
+		TAILQ_REMOVE(&sce->cring_queue, req, entries);
+		LIST_REMOVE(req, hash_entries);
+		ugen_put_request(sce, req);
+	}
+	rw_exit_write(&sce->q_lock);
+	rw_exit_write(&sce->cq_lock);
+	splx(s);
+	if (cq != NULL)
+		free(cq, M_USBDEV, UGEN_CQSIZE * sizeof(*cq));
+}
+
 int
 ugen_do_close(struct ugen_softc *sc, int endpt, int flag)
 {
 	struct ugen_endpoint *sce;
 	int dir, i;
-	struct usb_ctl_request *req;
+	struct usb_cring *cring;
 	int s;
 
 #ifdef DIAGNOSTIC
@@ -462,21 +1129,22 @@ ugen_do_close(struct ugen_softc *sc, int endpt, int flag)
 		return (EINVAL);
 	}
 #endif
+	/* The OUT side uses the ring and pool of the IN side. */
+	ugen_async_drain(&sc->sc_endpoints[endpt][OUT], endpt);
 	sce = &sc->sc_endpoints[endpt][IN];
+	ugen_async_drain(sce, endpt);
 	s = splusb();
-	rw_enter_write(&q_lock);
-	//while ((req = TAILQ_FIRST(&sce->submit_queue))) {
-	//	TAILQ_REMOVE(&sce->submit_queue, req, entries);
-	//	usbd_free_xfer(req->xfer);
-	//	free(req, M_TEMP, sizeof(*req));
-	//}
-	while ((req = TAILQ_FIRST(&sce->complete_queue))) {
-		TAILQ_REMOVE(&sce->complete_queue, req, entries);
-		usbd_free_xfer(req->xfer);
-		free(req, M_TEMP, sizeof(*req));
-	}
-	rw_exit_write(&q_lock);
+	cring = sce->cring;
+	sce->cring = NULL;
+	if (cring != NULL && sce->cring_mapped) {
+		/* Still mapped maybe, see ugen_cring_setup. */
+		sce->cring_kept = cring;
+		cring = NULL;
+	}
 	splx(s);
+	if (cring != NULL)
+		km_free(cring, sce->cring_len, &kv_any, &kp_zero);
+	ugen_pool_destroy(sce);
 
 	if (endpt == USB_CONTROL_ENDPOINT) {
 		DPRINTFN(5, ("ugenclose: close control\n"));
@@ -493,17 +1161,40 @@ ugen_do_close(struct ugen_softc *sc, int endpt, int flag)
 		DPRINTFN(5, ("ugenclose: endpt=%d dir=%d sce=%p\n",
 			     endpt, dir, sce));
 
+		if (sce->state & UGEN_RA)
+			ugen_bulkra_stop(sce);
+		if (sce->state & UGEN_WB) {
+			/* Push out what was written, errors are lost. */
+			if (!usbd_is_dying(sc->sc_udev))
+				(void)ugen_bulkwb_drain(sc, sce);
+			ugen_bulkwb_stop(sce);
+		}
 		usbd_close_pipe(sce->pipeh);
 		sce->pipeh = NULL;
 
+		if (sce->bxfer != NULL) {
+			usbd_free_xfer(sce->bxfer);
+			sce->bxfer = NULL;
+		}
+
 		switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 		case UE_INTERRUPT:
-			ndflush(&sce->q, sce->q.c_cc);
-			clfree(&sce->q);
+			if (sce->ipkts == NULL)
+				break;
+			free(sce->ipkts, M_USBDEV,
+			    sce->nipkts * sce->ipktsize);
+			sce->ipkts = NULL;
 			break;
 		case UE_ISOCHRONOUS:
-			for (i = 0; i < UGEN_NISOREQS; ++i)
+			if (sce->isoreqs == NULL)
+				break;
+			for (i = 0; i < sce->nisoreqs; ++i)
 				usbd_free_xfer(sce->isoreqs[i].xfer);
+			free(sce->isoreqs[0].sizes, M_USBDEV,
+			    sce->nisoreqs * sce->nisorfrms * sizeof(u_int16_t));
+			free(sce->isoreqs, M_USBDEV,
+			    sce->nisoreqs * sizeof(*sce->isoreqs));
+			sce->isoreqs = NULL;
 
 		default:
 			break;
@@ -524,12 +1215,12 @@ ugen_do_read(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 {
 	struct ugen_endpoint *sce = &sc->sc_endpoints[endpt][IN];
 	u_int32_t n, tn;
-	char buf[UGEN_BBSIZE];
+	void *buf;
 	struct usbd_xfer *xfer;
 	usbd_status err;
-	int s;
+	int s, size;
 	int flags, error = 0;
-	u_char buffer[UGEN_CHUNK];
+	struct usb_intr_packet *pkt;
 
 	DPRINTFN(5, ("%s: ugenread: %d\n", sc->sc_dev.dv_xname, endpt));
 
@@ -552,9 +1243,11 @@ ugen_do_read(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 
 	switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 	case UE_INTERRUPT:
+		if (sce->state & UGEN_ASYNC)
+			return (EBUSY);
 		/* Block until activity occurred. */
 		s = splusb();
-		while (sce->q.c_cc == 0) {
+		while (sce->ipkt_head == sce->ipkt_tail) {
 			if (flag & IO_NDELAY) {
 				splx(s);
 				return (EWOULDBLOCK);
@@ -574,36 +1267,55 @@ ugen_do_read(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 			if (error)
 				break;
 		}
-		splx(s);
 
-		/* Transfer as many chunks as possible. */
-		while (sce->q.c_cc > 0 && uio->uio_resid > 0 && !error) {
-			n = min(sce->q.c_cc, uio->uio_resid);
-			if (n > sizeof(buffer))
-				n = sizeof(buffer);
-
-			/* Remove a small chunk from the input queue. */
-			q_to_b(&sce->q, buffer, n);
-			DPRINTFN(5, ("ugenread: got %d chars\n", n));
-
-			/* Copy the data to the user process. */
-			error = uiomovei(buffer, n, uio);
+		/*
+		 * Return one packet, truncated to the read size, or as
+		 * many whole records as fit.
+		 */
+		sce->state |= UGEN_IREAD;
+		tn = 0;
+		while (sce->ipkt_head != sce->ipkt_tail && !error) {
+			pkt = UGEN_IPKT(sce, sce->ipkt_tail);
+			if (!(sce->state & UGEN_IRECORDS)) {
+				n = min(pkt->uip_len, uio->uio_resid);
+				DPRINTFN(5, ("ugenread: got %d chars\n", n));
+				error = uiomovei(pkt + 1, n, uio);
+				sce->ipkt_tail++;
+				break;
+			}
+			n = USB_INTR_RECORD_SIZE(pkt->uip_len);
+			if (n > uio->uio_resid) {
+				if (tn == 0)
+					error = EMSGSIZE;
+				break;
+			}
+			error = uiomovei(pkt, n, uio);
 			if (error)
 				break;
+			sce->ipkt_tail++;
+			tn++;
 		}
+		sce->state &= ~UGEN_IREAD;
+		splx(s);
 		break;
 	case UE_BULK:
-		xfer = usbd_alloc_xfer(sc->sc_udev);
+		if (sce->state & UGEN_RA) {
+			error = ugen_read_ring(sc, sce, uio, flag);
+			break;
+		}
+		size = ugen_bulk_xfersize(sce, uio);
+		xfer = ugen_get_bxfer(sc, sce, size);
 		if (xfer == 0)
 			return (ENOMEM);
-		flags = USBD_SYNCHRONOUS;
+		buf = KERNADDR(&xfer->dmabuf, 0);
+		flags = USBD_SYNCHRONOUS | USBD_NO_COPY;
 		if (sce->state & UGEN_SHORT_OK)
 			flags |= USBD_SHORT_XFER_OK;
 		if (sce->timeout == 0)
 			flags |= USBD_CATCH;
-		while ((n = min(UGEN_BBSIZE, uio->uio_resid)) != 0) {
+		while ((n = min(size, uio->uio_resid)) != 0) {
 			DPRINTFN(1, ("ugenread: start transfer %d bytes\n",n));
-			usbd_setup_xfer(xfer, sce->pipeh, 0, buf, n,
+			usbd_setup_xfer(xfer, sce->pipeh, 0, NULL, n,
 			    flags, sce->timeout, NULL);
 			err = usbd_transfer(xfer);
 			if (err) {
@@ -622,57 +1334,164 @@ ugen_do_read(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 			if (error || tn < n)
 				break;
 		}
-		usbd_free_xfer(xfer);
+		ugen_put_bxfer(sce, xfer);
 		break;
 	case UE_ISOCHRONOUS:
-		s = splusb();
-		while (sce->cur == sce->fill) {
-			if (flag & IO_NDELAY) {
-				splx(s);
-				return (EWOULDBLOCK);
-			}
-			sce->state |= UGEN_ASLP;
-			DPRINTFN(5, ("ugenread: sleep on %p\n", sce));
-			error = tsleep(sce, PZERO | PCATCH, "ugenri",
-			    (sce->timeout * hz) / 1000);
-			sce->state &= ~UGEN_ASLP;
-			DPRINTFN(5, ("ugenread: woke, error=%d\n", error));
-			if (usbd_is_dying(sc->sc_udev))
-				error = EIO;
-			if (error == EWOULDBLOCK) {	/* timeout, return 0 */
-				error = 0;
-				break;
-			}
-			if (error)
-				break;
-		}
-
-		while (sce->cur != sce->fill && uio->uio_resid > 0 && !error) {
-			if(sce->fill > sce->cur)
-				n = min(sce->fill - sce->cur, uio->uio_resid);
-			else
-				n = min(sce->limit - sce->cur, uio->uio_resid);
+		if (sce->state & UGEN_ASYNC)
+			return (EBUSY);
+		error = ugen_isoc_start(sc, sce);
+		if (error)
+			return (error);
+		error = ugen_read_ring(sc, sce, uio, flag);
+		break;
+	default:
+		return (ENXIO);
+	}
+	return (error);
+}
 
-			DPRINTFN(5, ("ugenread: isoc got %d chars\n", n));
+/*
+ * Read from the circular buffer filled by the isoc or bulk read-ahead
+ * transfers.
+ */
+int
+ugen_read_ring(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct uio *uio, int flag)
+{
+	u_int32_t n;
+	int s, error = 0;
 
-			/* Copy the data to the user process. */
-			error = uiomovei(sce->cur, n, uio);
-			if (error)
-				break;
-			sce->cur += n;
-			if(sce->cur >= sce->limit)
-				sce->cur = sce->ibuf;
+	s = splusb();
+	while (sce->cur == sce->fill) {
+		if ((sce->state & UGEN_RA) && sce->ra_inflight == 0) {
+			/* All read-ahead transfers have failed. */
+			splx(s);
+			return (EIO);
 		}
-		splx(s);
-		break;
+		if (flag & IO_NDELAY) {
+			splx(s);
+			return (EWOULDBLOCK);
+		}
+		sce->state |= UGEN_ASLP;
+		DPRINTFN(5, ("ugenread: sleep on %p\n", sce));
+		error = tsleep(sce, PZERO | PCATCH, "ugenri",
+		    (sce->timeout * hz) / 1000);
+		sce->state &= ~UGEN_ASLP;
+		DPRINTFN(5, ("ugenread: woke, error=%d\n", error));
+		if (usbd_is_dying(sc->sc_udev))
+			error = EIO;
+		if (error == EWOULDBLOCK) {	/* timeout, return 0 */
+			error = 0;
+			break;
+		}
+		if (error)
+			break;
+	}
 
+	while (sce->cur != sce->fill && uio->uio_resid > 0 && !error) {
+		if(sce->fill > sce->cur)
+			n = min(sce->fill - sce->cur, uio->uio_resid);
+		else
+			n = min(sce->limit - sce->cur, uio->uio_resid);
 
-	default:
-		return (ENXIO);
+		DPRINTFN(5, ("ugenread: ring got %d chars\n", n));
+
+		/* Copy the data to the user process. */
+		error = uiomovei(sce->cur, n, uio);
+		if (error)
+			break;
+		sce->cur += n;
+		if(sce->cur >= sce->limit)
+			sce->cur = sce->ibuf;
 	}
+	splx(s);
 	return (error);
 }
 
+/*
+ * Size of the synchronous bulk transfers of a read or write.  A readv
+ * or writev gets one transfer spanning all of its segments, so that
+ * e.g. a header, payload and trailer do not need to be copied
+ * together in userland and still go out as one transfer.
+ */
+int
+ugen_bulk_xfersize(struct ugen_endpoint *sce, struct uio *uio)
+{
+	if (uio->uio_iovcnt > 1 && uio->uio_resid > sce->bsize)
+		return (uio->uio_resid > UGEN_BBSIZE_MAX ?
+		    UGEN_BBSIZE_MAX : uio->uio_resid);
+	return (sce->bsize);
+}
+
+/*
+ * Get a transfer with a size bytes DMA buffer for synchronous bulk
+ * read or write.  The endpoint keeps one of bsize bytes around,
+ * concurrent callers and larger sizes get a private one.
+ */
+struct usbd_xfer *
+ugen_get_bxfer(struct ugen_softc *sc, struct ugen_endpoint *sce, int size)
+{
+	struct usbd_xfer *xfer;
+	int cache = 0;
+
+	if (size == sce->bsize && !(sce->state & UGEN_BBUSY)) {
+		sce->state |= UGEN_BBUSY;
+		if (sce->bxfer != NULL)
+			return (sce->bxfer);
+		cache = 1;
+	}
+	xfer = usbd_alloc_xfer(sc->sc_udev);
+	if (xfer == NULL)
+		goto fail;
+	if (usbd_alloc_buffer(xfer, size) == NULL) {
+		usbd_free_xfer(xfer);
+		goto fail;
+	}
+	if (cache)
+		sce->bxfer = xfer;
+	return (xfer);
+
+fail:
+	if (cache)
+		sce->state &= ~UGEN_BBUSY;
+	return (NULL);
+}
+
+void
+ugen_put_bxfer(struct ugen_endpoint *sce, struct usbd_xfer *xfer)
+{
+	if (xfer == sce->bxfer)
+		sce->state &= ~UGEN_BBUSY;
+	else
+		usbd_free_xfer(xfer);
+}
+
+/*
+ * Change the bulk read/write transfer size of both directions of an
+ * endpoint.  The cached transfers are reallocated on next use.
+ */
+int
+ugen_set_bsize(struct ugen_softc *sc, int endpt, int bsize)
+{
+	struct ugen_endpoint *sce;
+	int dir;
+
+	if (bsize < UGEN_BBSIZE || bsize > UGEN_BBSIZE_MAX)
+		return (EINVAL);
+	for (dir = OUT; dir <= IN; dir++)
+		if (sc->sc_endpoints[endpt][dir].state & UGEN_BBUSY)
+			return (EBUSY);
+	for (dir = OUT; dir <= IN; dir++) {
+		sce = &sc->sc_endpoints[endpt][dir];
+		if (sce->bxfer != NULL) {
+			usbd_free_xfer(sce->bxfer);
+			sce->bxfer = NULL;
+		}
+		sce->bsize = bsize;
+	}
+	return (0);
+}
+
 int
 ugenread(dev_t dev, struct uio *uio, int flag)
 {
@@ -694,8 +1513,9 @@ ugen_do_write(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 {
 	struct ugen_endpoint *sce = &sc->sc_endpoints[endpt][OUT];
 	u_int32_t n;
-	int flags, error = 0;
+	int flags, size, error = 0;
 	char buf[UGEN_BBSIZE];
+	void *bbuf;
 	struct usbd_xfer *xfer;
 	usbd_status err;
 
@@ -723,16 +1543,22 @@ ugen_do_write(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 
 	switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 	case UE_BULK:
-		xfer = usbd_alloc_xfer(sc->sc_udev);
+		if (sce->state & UGEN_WB) {
+			error = ugen_write_ring(sc, sce, uio, flag);
+			break;
+		}
+		size = ugen_bulk_xfersize(sce, uio);
+		xfer = ugen_get_bxfer(sc, sce, size);
 		if (xfer == 0)
 			return (EIO);
-		while ((n = min(UGEN_BBSIZE, uio->uio_resid)) != 0) {
-			error = uiomovei(buf, n, uio);
+		bbuf = KERNADDR(&xfer->dmabuf, 0);
+		while ((n = min(size, uio->uio_resid)) != 0) {
+			error = uiomovei(bbuf, n, uio);
 			if (error)
 				break;
 			DPRINTFN(1, ("ugenwrite: transfer %d bytes\n", n));
-			usbd_setup_xfer(xfer, sce->pipeh, 0, buf, n,
-			    flags, sce->timeout, NULL);
+			usbd_setup_xfer(xfer, sce->pipeh, 0, NULL, n,
+			    flags | USBD_NO_COPY, sce->timeout, NULL);
 			err = usbd_transfer(xfer);
 			if (err) {
 				usbd_clear_endpoint_stall(sce->pipeh);
@@ -745,7 +1571,7 @@ ugen_do_write(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 				break;
 			}
 		}
-		usbd_free_xfer(xfer);
+		ugen_put_bxfer(sce, xfer);
 		break;
 	case UE_INTERRUPT:
 		xfer = usbd_alloc_xfer(sc->sc_udev);
@@ -779,6 +1605,53 @@ ugen_do_write(struct ugen_softc *sc, int endpt, struct uio *uio, int flag)
 	return (error);
 }
 
+/*
+ * Copy into the write-behind ring, sleeping only while it is full.
+ */
+int
+ugen_write_ring(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct uio *uio, int flag)
+{
+	u_int32_t n;
+	int s, error = 0;
+
+	s = splusb();
+	while (uio->uio_resid > 0) {
+		if (sce->wb_error) {
+			error = sce->wb_error;
+			break;
+		}
+		if (UGEN_RING_SPACE(sce) == 0) {
+			if (flag & IO_NDELAY) {
+				error = EWOULDBLOCK;
+				break;
+			}
+			sce->state |= UGEN_ASLP;
+			DPRINTFN(5, ("ugenwrite: sleep on %p\n", sce));
+			error = tsleep(sce, PZERO | PCATCH, "ugenwb", 0);
+			sce->state &= ~UGEN_ASLP;
+			if (usbd_is_dying(sc->sc_udev))
+				error = EIO;
+			if (error)
+				break;
+			continue;
+		}
+		n = min(UGEN_RING_SPACE(sce), uio->uio_resid);
+		if (n > sce->limit - sce->fill)
+			n = sce->limit - sce->fill;
+		DPRINTFN(5, ("ugenwrite: ring put %d chars\n", n));
+		error = uiomovei(sce->fill, n, uio);
+		if (error)
+			break;
+		sce->fill += n;
+		if (sce->fill == sce->limit)
+			sce->fill = sce->ibuf;
+		ugen_bulkwb_kick(sce);
+	}
+	splx(s);
+	return (error);
+}
+
 int
 ugenwrite(dev_t dev, struct uio *uio, int flag)
 {
@@ -817,8 +1690,10 @@ ugen_detach(struct device *self, int flags)
 	s = splusb();
 	if (--sc->sc_refcnt >= 0) {
 		/* Wake everyone */
-		for (i = 0; i < USB_MAX_ENDPOINTS; i++)
+		for (i = 0; i < USB_MAX_ENDPOINTS; i++) {
 			wakeup(&sc->sc_endpoints[i][IN]);
+			wakeup(&sc->sc_endpoints[i][OUT]);
+		}
 		/* Wait for processes to go away. */
 		usb_detach_wait(&sc->sc_dev);
 	}
@@ -837,6 +1712,21 @@ ugen_detach(struct device *self, int flags)
 		if (sc->sc_is_open[endptno])
 			ugen_do_close(sc, endptno, FREAD|FWRITE);
 	}
+
+	/*
+	 * Rings and pools kept for a mapping cannot be faulted in any
+	 * more.
+	 */
+	for (endptno = 0; endptno < USB_MAX_ENDPOINTS; endptno++) {
+		sce = &sc->sc_endpoints[endptno][IN];
+		if (sce->cring_kept != NULL) {
+			km_free(sce->cring_kept, sce->cring_len, &kv_any,
+			    &kp_zero);
+			sce->cring_kept = NULL;
+		}
+		sce->pool_mapped = 0;
+		ugen_pool_destroy(sce);
+	}
 	return (0);
 }
 
@@ -845,6 +1735,7 @@ ugenintr(struct usbd_xfer *xfer, void *addr, usbd_status status)
 {
 	struct ugen_endpoint *sce = addr;
 	/*struct ugen_softc *sc = sce->sc;*/
+	struct usb_intr_packet *pkt;
 	u_int32_t count;
 	u_char *ibuf;
 
@@ -866,7 +1757,17 @@ ugenintr(struct usbd_xfer *xfer, void *addr, usbd_status status)
 	DPRINTFN(5, ("          data = %02x %02x %02x\n",
 		     ibuf[0], ibuf[1], ibuf[2]));
 
-	(void)b_to_q(ibuf, count, &sce->q);
+	/* Drop the new packet rather than one a reader may be copying. */
+	if (sce->ipkt_head - sce->ipkt_tail >= sce->nipkts) {
+		sce->ipkt_drops++;
+		DPRINTF(("ugenintr: ring full, dropping %d bytes\n", count));
+		return;
+	}
+	pkt = UGEN_IPKT(sce, sce->ipkt_head);
+	pkt->uip_len = count;
+	nanouptime(&pkt->uip_time);
+	memcpy(pkt + 1, ibuf, count);
+	sce->ipkt_head++;
 
 	if (sce->state & UGEN_ASLP) {
 		sce->state &= ~UGEN_ASLP;
@@ -900,8 +1801,8 @@ ugen_isoc_rintr(struct usbd_xfer *xfer, void *addr, usbd_status status)
 		DPRINTFN(5, ("%s: throwing away %d bytes\n", __func__, count));
 	}
 
-	isize = UGETW(sce->edesc->wMaxPacketSize);
-	for (i = 0; i < UGEN_NISORFRMS; i++) {
+	isize = sce->isize;
+	for (i = 0; i < sce->nisorfrms; i++) {
 		u_int32_t actlen = req->sizes[i];
 		char const *buf = (char const *)req->dmabuf + isize * i;
 
@@ -921,7 +1822,7 @@ ugen_isoc_rintr(struct usbd_xfer *xfer, void *addr, usbd_status status)
 		req->sizes[i] = isize;
 	}
 
-	usbd_setup_isoc_xfer(xfer, sce->pipeh, req, req->sizes, UGEN_NISORFRMS,
+	usbd_setup_isoc_xfer(xfer, sce->pipeh, req, req->sizes, sce->nisorfrms,
 	    USBD_NO_COPY | USBD_SHORT_XFER_OK, ugen_isoc_rintr);
 	(void)usbd_transfer(xfer);
 
@@ -933,162 +1834,602 @@ ugen_isoc_rintr(struct usbd_xfer *xfer, void *addr, usbd_status status)
 	selwakeup(&sce->rsel);
 }
 
-int 
-ugen_set_interface(struct ugen_softc *sc, int ifaceidx, int altno)
+/*
+ * Allocate the isoc read ring with the geometry of the endpoint and
+ * start its transfers.  This is done on first use, so that the geometry
+ * can still be changed after open.
+ */
+int
+ugen_isoc_start(struct ugen_softc *sc, struct ugen_endpoint *sce)
 {
-	struct usbd_interface *iface;
-	usb_config_descriptor_t *cdesc;
-	usb_interface_descriptor_t *id;
-	usb_endpoint_descriptor_t *ed;
-	struct ugen_endpoint *sce;
-	uint8_t  endptno, endpt;
-	int dir, err;
-
-	DPRINTFN(15, ("ugen_set_interface %d %d\n", ifaceidx, altno));
+	struct isoreq *reqs;
+	u_int16_t *sizes;
+	u_char *ibuf;
+	int nframes = sce->nisoframes;
+	int nreqs = sce->nisoreqs, nfrms = sce->nisorfrms;
+	int error = ENOMEM;
+	int i, j, s;
 
-	cdesc = usbd_get_config_descriptor(sc->sc_udev);
-	if (ifaceidx < 0 || ifaceidx >= cdesc->bNumInterface ||
-	    usbd_iface_claimed(sc->sc_udev, ifaceidx))
-		return (USBD_INVAL);
+	if (sce->ibuf != NULL || (sce->state & UGEN_ASYNC))
+		return (0);
+	if (sce->pipeh == NULL)
+		return (EIO);
 
-	err = usbd_device2interface_handle(sc->sc_udev, ifaceidx, &iface);
-	if (err)
-		return (err);
-	id = usbd_get_interface_descriptor(iface);
-	for (endptno = 0; endptno < id->bNumEndpoints; endptno++) {
-		ed = usbd_interface2endpoint_descriptor(iface,endptno);
-		endpt = ed->bEndpointAddress;
-		dir = UE_GET_DIR(endpt) == UE_DIR_IN ? IN : OUT;
-		sce = &sc->sc_endpoints[UE_GET_ADDR(endpt)][dir];
-		sce->sc = 0;
-		sce->edesc = 0;
-		sce->iface = 0;
+	ibuf = mallocarray(sce->isize, nframes, M_USBDEV, M_WAITOK);
+	reqs = mallocarray(nreqs, sizeof(*reqs), M_USBDEV, M_WAITOK | M_ZERO);
+	sizes = mallocarray(nreqs * nfrms, sizeof(*sizes), M_USBDEV,
+	    M_WAITOK);
+	for (i = 0; i < nreqs; i++) {
+		reqs[i].sce = sce;
+		reqs[i].sizes = sizes + i * nfrms;
+		reqs[i].xfer = usbd_alloc_xfer(sc->sc_udev);
+		if (reqs[i].xfer == NULL)
+			goto bad;
+		reqs[i].dmabuf = usbd_alloc_buffer(reqs[i].xfer,
+		    sce->isize * nfrms);
+		if (reqs[i].dmabuf == NULL) {
+			i++;
+			goto bad;
+		}
+	}
+	/* Somebody else may have started it while we slept. */
+	if (sce->ibuf != NULL || (sce->state & UGEN_ASYNC)) {
+		error = 0;
+		goto bad;
 	}
 
-	/* change setting */
-	err = usbd_set_interface(iface, altno);
-	if (err)
-		return (err);
+	sce->ibuf = ibuf;
+	sce->cur = sce->fill = sce->ibuf;
+	sce->limit = sce->ibuf + sce->isize * nframes;
+	sce->isoreqs = reqs;
+	sce->nisoreqs = nreqs;
+	sce->nisorfrms = nfrms;
 
-	id = usbd_get_interface_descriptor(iface);
-	for (endptno = 0; endptno < id->bNumEndpoints; endptno++) {
-		ed = usbd_interface2endpoint_descriptor(iface,endptno);
-		endpt = ed->bEndpointAddress;
-		dir = UE_GET_DIR(endpt) == UE_DIR_IN ? IN : OUT;
-		sce = &sc->sc_endpoints[UE_GET_ADDR(endpt)][dir];
-		sce->sc = sc;
-		sce->edesc = ed;
-		sce->iface = iface;
+	s = splusb();
+	for (i = 0; i < nreqs; i++) {
+		for (j = 0; j < nfrms; j++)
+			reqs[i].sizes[j] = sce->isize;
+		usbd_setup_isoc_xfer(reqs[i].xfer, sce->pipeh, &reqs[i],
+		    reqs[i].sizes, nfrms, USBD_NO_COPY | USBD_SHORT_XFER_OK,
+		    ugen_isoc_rintr);
+		(void)usbd_transfer(reqs[i].xfer);
 	}
-	return (err);
+	splx(s);
+	DPRINTFN(5, ("ugen_isoc_start: %d x %d frames of %d bytes, "
+	    "ring %d frames\n", nreqs, nfrms, sce->isize, nframes));
+	return (0);
+
+bad:
+	while (--i >= 0) /* implicit buffer free */
+		usbd_free_xfer(reqs[i].xfer);
+	free(sizes, M_USBDEV, nreqs * nfrms * sizeof(*sizes));
+	free(reqs, M_USBDEV, nreqs * sizeof(*reqs));
+	free(ibuf, M_USBDEV, sce->isize * nframes);
+	return (error);
 }
 
+/*
+ * Change the isoc read ring geometry of an endpoint before it starts.
+ * Fields left at zero keep their current value.  The ring has to hold
+ * at least two transfers, so that read(2) can drain one while the next
+ * is filled.
+ */
 int
-ugen_get_alt_index(struct ugen_softc *sc, int ifaceidx)
+ugen_isoc_geometry(struct ugen_endpoint *sce, struct usb_isoc_geometry *uig)
 {
-	struct usbd_interface *iface;
-	usbd_status err;
+	int frames = sce->nisoframes;
+	int xfers = sce->nisoreqs, xferframes = sce->nisorfrms;
 
-	err = usbd_device2interface_handle(sc->sc_udev, ifaceidx, &iface);
-	if (err)
-		return (-1);
-	return (usbd_get_interface_altindex(iface));
+	if (sce->pipeh == NULL || sce->edesc == NULL ||
+	    (sce->edesc->bmAttributes & UE_XFERTYPE) != UE_ISOCHRONOUS ||
+	    UE_GET_DIR(sce->edesc->bEndpointAddress) != UE_DIR_IN)
+		return (EINVAL);
+	if (sce->ibuf != NULL || (sce->state & UGEN_ASYNC))
+		return (EBUSY);
+
+	if (uig->uig_frames != 0)
+		frames = uig->uig_frames;
+	if (uig->uig_xfers != 0)
+		xfers = uig->uig_xfers;
+	if (uig->uig_xferframes != 0)
+		xferframes = uig->uig_xferframes;
+	if (xfers < 1 || xfers > USB_ISOC_MAXXFERS ||
+	    xferframes < 1 || xferframes > USB_ISOC_MAXXFERFRAMES ||
+	    frames < 2 * xferframes || frames > USB_ISOC_MAXBUF / sce->isize)
+		return (EINVAL);
+
+	sce->nisoframes = frames;
+	sce->nisoreqs = xfers;
+	sce->nisorfrms = xferframes;
+	uig->uig_frames = frames;
+	uig->uig_xfers = xfers;
+	uig->uig_xferframes = xferframes;
+	uig->uig_pktsize = sce->isize;
+	return (0);
 }
 
-int ugen_submit_ctrl(struct ugen_softc *sc, struct
-    usb_ctl_request *req, struct proc *p) {
-	struct usb_ctl_request *kreq;
-	struct usbd_xfer *xfer;
-	int len;
-	void *buf;
-	struct uio uio;
-	struct iovec iov;
-	int error = 0;
-	int err;
-	int flags = 0;
-	struct ugen_endpoint *sce = req->ucr_sce;
+/*
+ * Resize the interrupt packet ring of an endpoint, which drops what is
+ * queued, and set its read mode.  Not while a read(2), which may sleep
+ * in uiomove with a packet of the ring, is copying out.
+ */
+int
+ugen_intr_ring(struct ugen_endpoint *sce, struct usb_intr_ring *uir)
+{
+	u_char *pkts = NULL, *opkts = NULL;
+	int npkts = uir->uir_packets, onpkts = 0;
 	int s;
 
-	len = UGETW(req->ucr_request.wLength);
-
-	/* Avoid requests that would damage the bus integrity. */
-	if ((req->ucr_request.bmRequestType == UT_WRITE_DEVICE &&
-	     req->ucr_request.bRequest == UR_SET_ADDRESS) ||
-	    (req->ucr_request.bmRequestType == UT_WRITE_DEVICE &&
-	     req->ucr_request.bRequest == UR_SET_CONFIG) ||
-	    (req->ucr_request.bmRequestType == UT_WRITE_INTERFACE &&
-	     req->ucr_request.bRequest == UR_SET_INTERFACE))
+	if (sce->pipeh == NULL || sce->ipkts == NULL)
 		return (EINVAL);
-	if (len < 0 || len > 32767)
+	if (npkts < 0 || npkts > USB_INTR_MAXPACKETS || !powerof2(npkts) ||
+	    (uir->uir_flags & ~USB_INTR_RECORDS))
 		return (EINVAL);
 
-	kreq = malloc(sizeof(*kreq), M_TEMP, M_WAITOK);
-	if (kreq == NULL)
-		return (ENOMEM);
-	*kreq = *req;
+	if (npkts != 0 && npkts != sce->nipkts)
+		pkts = mallocarray(npkts, sce->ipktsize, M_USBDEV,
+		    M_WAITOK | M_ZERO);
 
-	xfer = usbd_alloc_xfer(sc->sc_udev);
-	if (xfer == NULL) {
-		free(kreq, M_TEMP, sizeof(*kreq));
-		return (ENOMEM);
-	}
-	if (len != 0) {
-		iov.iov_base = (caddr_t)req->ucr_data;
-		iov.iov_len = len;
-		uio.uio_iov = &iov;
-		uio.uio_iovcnt = 1;
-		uio.uio_resid = len;
-		uio.uio_offset = 0;
-		uio.uio_segflg = UIO_USERSPACE;
-		uio.uio_rw =
-		    req->ucr_request.bmRequestType & UT_READ ?
-		    UIO_READ : UIO_WRITE;
-		uio.uio_procp = p;
-		buf = usbd_alloc_buffer(xfer, len);
-		if (buf == NULL) {
-			usbd_free_xfer(xfer);
-			free(kreq, M_TEMP, sizeof(*kreq));
-			return (ENOMEM);
-		}
-		if (uio.uio_rw == UIO_WRITE) {
-			error = uiomove(buf, len, &uio);
-			if (error) {
-				usbd_free_xfer(xfer);
-				free(kreq, M_TEMP, sizeof(*kreq));
-				return (error);
-			}
-		}
-	}
-	if (kreq->ucr_flags & USBD_SHORT_XFER_OK)
-		flags = USBD_SHORT_XFER_OK;
-	usbd_setup_default_xfer(xfer, xfer->device, kreq,
-	    kreq->ucr_timeout, &kreq->ucr_request,
-	    NULL, len, flags | USBD_NO_COPY, ugen_async_callback);
-	kreq->xfer = xfer;
 	s = splusb();
-	err = usbd_transfer(xfer);
-	if (err != USBD_IN_PROGRESS) {
+	if (sce->state & UGEN_IREAD) {
 		splx(s);
-		usbd_clear_endpoint_stall(sce->pipeh);
-		if (err == USBD_INTERRUPTED)
-			error = EINTR;
-		else if (err == USBD_TIMEOUT)
-			error = ETIMEDOUT;
-		else
-			error = EIO;
-		usbd_free_xfer(xfer);
-		free(kreq, M_TEMP, sizeof(*kreq));
-		return (error);
+		if (pkts != NULL)
+			free(pkts, M_USBDEV, npkts * sce->ipktsize);
+		return (EBUSY);
 	}
-	rw_enter_write(&q_lock);
-	TAILQ_INSERT_TAIL(&sce->submit_queue, kreq, entries);
-	rw_exit_write(&q_lock);
+	if (pkts != NULL) {
+		opkts = sce->ipkts;
+		onpkts = sce->nipkts;
+		sce->ipkts = pkts;
+		sce->nipkts = npkts;
+		sce->ipkt_head = sce->ipkt_tail = 0;
+	}
+	if (uir->uir_flags & USB_INTR_RECORDS)
+		sce->state |= UGEN_IRECORDS;
+	else
+		sce->state &= ~UGEN_IRECORDS;
 	splx(s);
+
+	if (opkts != NULL)
+		free(opkts, M_USBDEV, onpkts * sce->ipktsize);
+	ugen_intr_ring_status(sce, uir);
 	return (0);
 }
 
-int ugen_submit_bulk(struct ugen_softc *sc, struct
-    usb_ctl_request *req, struct proc *p) {
+void
+ugen_intr_ring_status(struct ugen_endpoint *sce, struct usb_intr_ring *uir)
+{
+	int s;
+
+	s = splusb();
+	uir->uir_packets = sce->nipkts;
+	uir->uir_flags = (sce->state & UGEN_IRECORDS) ? USB_INTR_RECORDS : 0;
+	uir->uir_queued = sce->ipkt_head - sce->ipkt_tail;
+	uir->uir_drops = sce->ipkt_drops;
+	splx(s);
+}
+
+void
+ugen_bulkra_intr(struct usbd_xfer *xfer, void *addr, usbd_status status)
+{
+	struct ugen_endpoint *sce = addr;
+	u_int32_t count, n;
+	char const *buf;
+
+	if (status == USBD_CANCELLED) {
+		sce->ra_inflight--;
+		return;
+	}
+
+	if (status != USBD_NORMAL_COMPLETION) {
+		DPRINTF(("ugen_bulkra_intr: status=%d\n", status));
+		if (status == USBD_STALLED) {
+			usbd_clear_endpoint_stall_async(sce->pipeh);
+			sce->ra_inflight--;
+			goto wakeup;
+		}
+		/* Transient error, keep the read-ahead depth. */
+		goto resubmit;
+	}
+
+	usbd_get_xfer_status(xfer, NULL, NULL, &count, NULL);
+	buf = KERNADDR(&xfer->dmabuf, 0);
+
+	/* throw away oldest input if the buffer is full */
+	if (count > UGEN_RING_SPACE(sce)) {
+		n = count - UGEN_RING_SPACE(sce);
+		sce->cur += n;
+		if (sce->cur >= sce->limit)
+			sce->cur -= sce->limit - sce->ibuf;
+		sce->ra_overruns += n;
+		DPRINTFN(5, ("%s: throwing away %d bytes\n", __func__, n));
+	}
+
+	while (count > 0) {
+		n = min(count, sce->limit - sce->fill);
+		memcpy(sce->fill, buf, n);
+
+		buf += n;
+		count -= n;
+		sce->fill += n;
+		if (sce->fill == sce->limit)
+			sce->fill = sce->ibuf;
+	}
+
+resubmit:
+	usbd_setup_xfer(xfer, sce->pipeh, sce, NULL, sce->ra_xfersize,
+	    USBD_NO_COPY | USBD_SHORT_XFER_OK, USBD_NO_TIMEOUT,
+	    ugen_bulkra_intr);
+	if (usbd_transfer(xfer) != USBD_IN_PROGRESS)
+		sce->ra_inflight--;
+
+wakeup:
+	if (sce->state & UGEN_ASLP) {
+		sce->state &= ~UGEN_ASLP;
+		DPRINTFN(5, ("ugen_bulkra_intr: waking %p\n", sce));
+		wakeup(sce);
+	}
+	selwakeup(&sce->rsel);
+}
+
+/*
+ * Start bulk read-ahead on an IN endpoint: keep ubr_depth transfers in
+ * flight into a ring that read(2) drains.  It stays on until close and
+ * excludes async requests on the endpoint.
+ */
+int
+ugen_bulkra_start(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct usb_bulk_ra *ubr)
+{
+	struct usbd_xfer **xfers;
+	int depth = ubr->ubr_depth, xfersize = ubr->ubr_xfersize;
+	int bufsize, maxp, busy;
+	int i, s;
+
+	if (sce->pipeh == NULL || sce->edesc == NULL ||
+	    (sce->edesc->bmAttributes & UE_XFERTYPE) != UE_BULK)
+		return (EINVAL);
+	maxp = UGETW(sce->edesc->wMaxPacketSize);
+	if (depth <= 0 || depth > USB_BULK_RA_MAXDEPTH || maxp == 0 ||
+	    xfersize <= 0 || xfersize > UGEN_BBSIZE_MAX || xfersize % maxp)
+		return (EINVAL);
+	bufsize = ubr->ubr_bufsize;
+	if (bufsize == 0)
+		bufsize = 2 * depth * xfersize;
+	if (bufsize <= xfersize || bufsize > USB_BULK_RA_MAXBUF)
+		return (EINVAL);
+
+	/* Allocating may sleep, keep others out meanwhile. */
+	s = splusb();
+	busy = (sce->state & (UGEN_RA | UGEN_BBUSY | UGEN_SETUP)) ||
+	    !TAILQ_EMPTY(&sce->submit_queue);
+	if (!busy)
+		sce->state |= UGEN_SETUP;
+	splx(s);
+	if (busy)
+		return (EBUSY);
+
+	xfers = mallocarray(depth, sizeof(*xfers), M_USBDEV,
+	    M_WAITOK | M_ZERO);
+	for (i = 0; i < depth; i++) {
+		xfers[i] = usbd_alloc_xfer(sc->sc_udev);
+		if (xfers[i] == NULL)
+			goto bad;
+		if (usbd_alloc_buffer(xfers[i], xfersize) == NULL) {
+			i++;
+			goto bad;
+		}
+	}
+
+	sce->ibuf = malloc(bufsize, M_USBDEV, M_WAITOK);
+	sce->cur = sce->fill = sce->ibuf;
+	sce->limit = sce->ibuf + bufsize;
+	sce->raxfers = xfers;
+	sce->nraxfers = depth;
+	sce->ra_xfersize = xfersize;
+	sce->ra_overruns = 0;
+	sce->ra_inflight = 0;
+
+	s = splusb();
+	sce->state = (sce->state & ~UGEN_SETUP) | UGEN_RA;
+	for (i = 0; i < depth; i++) {
+		usbd_setup_xfer(xfers[i], sce->pipeh, sce, NULL, xfersize,
+		    USBD_NO_COPY | USBD_SHORT_XFER_OK, USBD_NO_TIMEOUT,
+		    ugen_bulkra_intr);
+		if (usbd_transfer(xfers[i]) == USBD_IN_PROGRESS)
+			sce->ra_inflight++;
+	}
+	splx(s);
+	DPRINTFN(5, ("ugen_bulkra_start: %d x %d bytes, ring %d\n",
+	    depth, xfersize, bufsize));
+
+	ubr->ubr_bufsize = bufsize;
+	ubr->ubr_inflight = sce->ra_inflight;
+	ubr->ubr_overruns = 0;
+	return (0);
+
+bad:
+	while (--i >= 0) /* implicit buffer free */
+		usbd_free_xfer(xfers[i]);
+	free(xfers, M_USBDEV, depth * sizeof(*xfers));
+	s = splusb();
+	sce->state &= ~UGEN_SETUP;
+	splx(s);
+	return (ENOMEM);
+}
+
+void
+ugen_bulkra_stop(struct ugen_endpoint *sce)
+{
+	int i, s;
+
+	s = splusb();
+	sce->state &= ~UGEN_RA;
+	usbd_abort_pipe(sce->pipeh);
+	splx(s);
+
+	for (i = 0; i < sce->nraxfers; i++)
+		usbd_free_xfer(sce->raxfers[i]);
+	free(sce->raxfers, M_USBDEV, sce->nraxfers * sizeof(*sce->raxfers));
+	sce->raxfers = NULL;
+	sce->nraxfers = 0;
+	free(sce->ibuf, M_USBDEV, sce->limit - sce->ibuf);
+	sce->ibuf = NULL;
+}
+
+/*
+ * Start write-behind transfers for the data in the ring, as long as
+ * there are idle ones.  Transfers on a pipe complete in order, so they
+ * are used round robin.  Must be called at splusb.
+ */
+void
+ugen_bulkwb_kick(struct ugen_endpoint *sce)
+{
+	struct usbd_xfer *xfer;
+	u_int32_t n, c, len;
+	char *buf;
+
+	while (sce->wb_inflight < sce->nwbxfers && sce->cur != sce->fill &&
+	    sce->wb_error == 0) {
+		xfer = sce->wbxfers[(sce->wb_first + sce->wb_inflight) %
+		    sce->nwbxfers];
+		buf = KERNADDR(&xfer->dmabuf, 0);
+		n = min(UGEN_RING_USED(sce), sce->wb_xfersize);
+		for (len = n; len > 0; len -= c) {
+			c = min(len, sce->limit - sce->cur);
+			memcpy(buf, sce->cur, c);
+			buf += c;
+			sce->cur += c;
+			if (sce->cur == sce->limit)
+				sce->cur = sce->ibuf;
+		}
+		usbd_setup_xfer(xfer, sce->pipeh, sce, NULL, n, USBD_NO_COPY,
+		    sce->timeout, ugen_bulkwb_intr);
+		if (usbd_transfer(xfer) != USBD_IN_PROGRESS) {
+			sce->wb_error = EIO;
+			break;
+		}
+		sce->wb_inflight++;
+	}
+}
+
+void
+ugen_bulkwb_intr(struct usbd_xfer *xfer, void *addr, usbd_status status)
+{
+	struct ugen_endpoint *sce = addr;
+
+	sce->wb_first = (sce->wb_first + 1) % sce->nwbxfers;
+	sce->wb_inflight--;
+
+	if (status == USBD_CANCELLED) {
+		if (sce->wb_error == 0)
+			sce->wb_error = EIO;
+	} else if (status != USBD_NORMAL_COMPLETION) {
+		DPRINTF(("ugen_bulkwb_intr: status=%d\n", status));
+		if (status == USBD_STALLED)
+			usbd_clear_endpoint_stall_async(sce->pipeh);
+		if (sce->wb_error == 0)
+			sce->wb_error = (status == USBD_TIMEOUT) ?
+			    ETIMEDOUT : EIO;
+	} else
+		ugen_bulkwb_kick(sce);
+
+	if (sce->state & UGEN_ASLP) {
+		sce->state &= ~UGEN_ASLP;
+		DPRINTFN(5, ("ugen_bulkwb_intr: waking %p\n", sce));
+		wakeup(sce);
+	}
+	selwakeup(&sce->rsel);
+}
+
+/*
+ * Start bulk write-behind on an OUT endpoint.  It stays on until close,
+ * which drains the ring.
+ */
+int
+ugen_bulkwb_start(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct usb_bulk_wb *ubw)
+{
+	struct usbd_xfer **xfers;
+	int depth = ubw->ubw_depth, xfersize = ubw->ubw_xfersize;
+	int bufsize, maxp, busy;
+	int i, s;
+
+	if (sce->pipeh == NULL || sce->edesc == NULL ||
+	    (sce->edesc->bmAttributes & UE_XFERTYPE) != UE_BULK)
+		return (EINVAL);
+	maxp = UGETW(sce->edesc->wMaxPacketSize);
+	if (depth <= 0 || depth > USB_BULK_RA_MAXDEPTH || maxp == 0 ||
+	    xfersize <= 0 || xfersize > UGEN_BBSIZE_MAX || xfersize % maxp)
+		return (EINVAL);
+	bufsize = ubw->ubw_bufsize;
+	if (bufsize == 0)
+		bufsize = 2 * depth * xfersize;
+	if (bufsize <= xfersize || bufsize > USB_BULK_RA_MAXBUF)
+		return (EINVAL);
+
+	/* As in ugen_bulkra_start, claim the endpoint before sleeping. */
+	s = splusb();
+	busy = (sce->state & (UGEN_WB | UGEN_BBUSY | UGEN_SETUP)) ||
+	    !TAILQ_EMPTY(&sce->submit_queue);
+	if (!busy)
+		sce->state |= UGEN_SETUP;
+	splx(s);
+	if (busy)
+		return (EBUSY);
+
+	xfers = mallocarray(depth, sizeof(*xfers), M_USBDEV,
+	    M_WAITOK | M_ZERO);
+	for (i = 0; i < depth; i++) {
+		xfers[i] = usbd_alloc_xfer(sc->sc_udev);
+		if (xfers[i] == NULL)
+			goto bad;
+		if (usbd_alloc_buffer(xfers[i], xfersize) == NULL) {
+			i++;
+			goto bad;
+		}
+	}
+
+	sce->ibuf = malloc(bufsize, M_USBDEV, M_WAITOK);
+	sce->cur = sce->fill = sce->ibuf;
+	sce->limit = sce->ibuf + bufsize;
+	sce->wbxfers = xfers;
+	sce->nwbxfers = depth;
+	sce->wb_xfersize = xfersize;
+	sce->wb_first = sce->wb_inflight = 0;
+	sce->wb_error = 0;
+	s = splusb();
+	sce->state = (sce->state & ~UGEN_SETUP) | UGEN_WB;
+	splx(s);
+	DPRINTFN(5, ("ugen_bulkwb_start: %d x %d bytes, ring %d\n",
+	    depth, xfersize, bufsize));
+
+	ubw->ubw_bufsize = bufsize;
+	return (0);
+
+bad:
+	while (--i >= 0) /* implicit buffer free */
+		usbd_free_xfer(xfers[i]);
+	free(xfers, M_USBDEV, depth * sizeof(*xfers));
+	s = splusb();
+	sce->state &= ~UGEN_SETUP;
+	splx(s);
+	return (ENOMEM);
+}
+
+/*
+ * Wait until everything written has been transferred and return, then
+ * clear, the first deferred error.  Data still in the ring after an
+ * error is discarded.
+ */
+int
+ugen_bulkwb_drain(struct ugen_softc *sc, struct ugen_endpoint *sce)
+{
+	int s, error = 0;
+
+	s = splusb();
+	while (sce->wb_inflight > 0 ||
+	    (sce->cur != sce->fill && sce->wb_error == 0)) {
+		sce->state |= UGEN_ASLP;
+		error = tsleep(sce, PZERO | PCATCH, "ugenwd", 0);
+		sce->state &= ~UGEN_ASLP;
+		if (usbd_is_dying(sc->sc_udev))
+			error = EIO;
+		if (error)
+			break;
+	}
+	if (error == 0) {
+		error = sce->wb_error;
+		sce->wb_error = 0;
+		sce->cur = sce->fill;
+	}
+	splx(s);
+	return (error);
+}
+
+void
+ugen_bulkwb_stop(struct ugen_endpoint *sce)
+{
+	int i, s;
+
+	s = splusb();
+	sce->state &= ~UGEN_WB;
+	usbd_abort_pipe(sce->pipeh);
+	splx(s);
+
+	for (i = 0; i < sce->nwbxfers; i++)
+		usbd_free_xfer(sce->wbxfers[i]);
+	free(sce->wbxfers, M_USBDEV, sce->nwbxfers * sizeof(*sce->wbxfers));
+	sce->wbxfers = NULL;
+	sce->nwbxfers = 0;
+	free(sce->ibuf, M_USBDEV, sce->limit - sce->ibuf);
+	sce->ibuf = NULL;
+}
+
+int 
+ugen_set_interface(struct ugen_softc *sc, int ifaceidx, int altno)
+{
+	struct usbd_interface *iface;
+	usb_config_descriptor_t *cdesc;
+	usb_interface_descriptor_t *id;
+	usb_endpoint_descriptor_t *ed;
+	struct ugen_endpoint *sce;
+	uint8_t  endptno, endpt;
+	int dir, err;
+
+	DPRINTFN(15, ("ugen_set_interface %d %d\n", ifaceidx, altno));
+
+	cdesc = usbd_get_config_descriptor(sc->sc_udev);
+	if (ifaceidx < 0 || ifaceidx >= cdesc->bNumInterface ||
+	    usbd_iface_claimed(sc->sc_udev, ifaceidx))
+		return (USBD_INVAL);
+
+	err = usbd_device2interface_handle(sc->sc_udev, ifaceidx, &iface);
+	if (err)
+		return (err);
+	id = usbd_get_interface_descriptor(iface);
+	for (endptno = 0; endptno < id->bNumEndpoints; endptno++) {
+		ed = usbd_interface2endpoint_descriptor(iface,endptno);
+		endpt = ed->bEndpointAddress;
+		dir = UE_GET_DIR(endpt) == UE_DIR_IN ? IN : OUT;
+		sce = &sc->sc_endpoints[UE_GET_ADDR(endpt)][dir];
+		sce->sc = 0;
+		sce->edesc = 0;
+		sce->iface = 0;
+	}
+
+	/* change setting */
+	err = usbd_set_interface(iface, altno);
+	if (err)
+		return (err);
+
+	id = usbd_get_interface_descriptor(iface);
+	for (endptno = 0; endptno < id->bNumEndpoints; endptno++) {
+		ed = usbd_interface2endpoint_descriptor(iface,endptno);
+		endpt = ed->bEndpointAddress;
+		dir = UE_GET_DIR(endpt) == UE_DIR_IN ? IN : OUT;
+		sce = &sc->sc_endpoints[UE_GET_ADDR(endpt)][dir];
+		sce->sc = sc;
+		sce->edesc = ed;
+		sce->iface = iface;
+	}
+	return (err);
+}
+
+int
+ugen_get_alt_index(struct ugen_softc *sc, int ifaceidx)
+{
+	struct usbd_interface *iface;
+	usbd_status err;
+
+	err = usbd_device2interface_handle(sc->sc_udev, ifaceidx, &iface);
+	if (err)
+		return (-1);
+	return (usbd_get_interface_altindex(iface));
+}
+
+int ugen_prepare_ctrl(struct ugen_softc *sc, struct
+    usb_ctl_request *req, struct usb_ctl_request **kreqp, struct proc *p) {
 	struct usb_ctl_request *kreq;
 	struct usbd_xfer *xfer;
 	int len;
@@ -1096,26 +2437,29 @@ int ugen_submit_bulk(struct ugen_softc *sc, struct
 	struct uio uio;
 	struct iovec iov;
 	int error = 0;
-	int err;
 	int flags = 0;
 	struct ugen_endpoint *sce = req->ucr_sce;
-	int s;
 
-	len = req->ucr_actlen;
+	len = UGETW(req->ucr_request.wLength);
 
-	if (len < 0) /* are bulk transfers of length zero allowed? */
+	/* Avoid requests that would damage the bus integrity. */
+	if ((req->ucr_request.bmRequestType == UT_WRITE_DEVICE &&
+	     req->ucr_request.bRequest == UR_SET_ADDRESS) ||
+	    (req->ucr_request.bmRequestType == UT_WRITE_DEVICE &&
+	     req->ucr_request.bRequest == UR_SET_CONFIG) ||
+	    (req->ucr_request.bmRequestType == UT_WRITE_INTERFACE &&
+	     req->ucr_request.bRequest == UR_SET_INTERFACE))
+		return (EINVAL);
+	if (len < 0 || len > 32767)
 		return (EINVAL);
 
-	kreq = malloc(sizeof(*kreq), M_TEMP, M_WAITOK);
-	if (kreq == NULL)
-		return (ENOMEM);
-	*kreq = *req;
+	error = ugen_alloc_request(sc, sce, req, len, &kreq, &buf);
+	if (error)
+		return (error);
+	kreq->ucr_read = (req->ucr_request.bmRequestType & UT_READ) != 0;
+	kreq->ucr_flags &= ~USBD_ZERO_COPY;
+	xfer = kreq->xfer;
 
-	xfer = usbd_alloc_xfer(sc->sc_udev);
-	if (xfer == NULL) {
-		free(kreq, M_TEMP, sizeof(*kreq));
-		return (ENOMEM);
-	}
 	if (len != 0) {
 		iov.iov_base = (caddr_t)req->ucr_data;
 		iov.iov_len = len;
@@ -1124,20 +2468,140 @@ int ugen_submit_bulk(struct ugen_softc *sc, struct
 		uio.uio_resid = len;
 		uio.uio_offset = 0;
 		uio.uio_segflg = UIO_USERSPACE;
-		uio.uio_rw = req->ucr_read ?
+		uio.uio_rw =
+		    req->ucr_request.bmRequestType & UT_READ ?
 		    UIO_READ : UIO_WRITE;
 		uio.uio_procp = p;
-		buf = usbd_alloc_buffer(xfer, len);
-		if (buf == NULL) {
-			usbd_free_xfer(xfer);
-			free(kreq, M_TEMP, sizeof(*kreq));
-			return (ENOMEM);
+		if (uio.uio_rw == UIO_WRITE) {
+			error = uiomove(buf, len, &uio);
+			if (error) {
+				ugen_put_request(sce, kreq);
+				return (error);
+			}
+		}
+	}
+	if (kreq->ucr_flags & USBD_SHORT_XFER_OK)
+		flags = USBD_SHORT_XFER_OK;
+	usbd_setup_default_xfer(xfer, xfer->device, kreq,
+	    kreq->ucr_timeout, &kreq->ucr_request,
+	    NULL, len, flags | USBD_NO_COPY, ugen_async_callback);
+	kreq->xfer = xfer;
+	*kreqp = kreq;
+	return (0);
+}
+
+/*
+ * Copy in the segments of a scatter-gather request.  Their total
+ * length becomes the length of the one transfer they are sent or
+ * received with.
+ */
+int
+ugen_copyin_iov(struct usb_ctl_request *req, struct iovec **kiovp)
+{
+	struct iovec *kiov;
+	size_t size;
+	int i, len, error;
+
+	if (req->ucr_iovcnt < 0 || req->ucr_iovcnt > USB_MAX_IOV ||
+	    (req->ucr_flags & USBD_ZERO_COPY))
+		return (EINVAL);
+	size = req->ucr_iovcnt * sizeof(*kiov);
+	kiov = malloc(size, M_USBDEV, M_WAITOK);
+	error = copyin(req->ucr_iov, kiov, size);
+	if (error)
+		goto bad;
+	len = 0;
+	for (i = 0; i < req->ucr_iovcnt; i++) {
+		if (kiov[i].iov_len > INT_MAX - len) {
+			error = EINVAL;
+			goto bad;
 		}
+		len += kiov[i].iov_len;
+	}
+	req->ucr_actlen = len;
+	*kiovp = kiov;
+	return (0);
+
+bad:
+	free(kiov, M_USBDEV, size);
+	return (error);
+}
+
+/*
+ * Describe the user data of a bulk or interrupt request, ucr_data or
+ * the segments of ucr_iov, by a uio of len bytes.  Moving data
+ * through the uio consumes the segments.
+ */
+void
+ugen_request_uio(struct usb_ctl_request *kreq, struct uio *uio,
+    struct iovec *iov, int len, struct proc *p)
+{
+	if (kreq->iov != NULL) {
+		uio->uio_iov = kreq->iov;
+		uio->uio_iovcnt = kreq->ucr_iovcnt;
+	} else {
+		iov->iov_base = (caddr_t)kreq->ucr_data;
+		iov->iov_len = len;
+		uio->uio_iov = iov;
+		uio->uio_iovcnt = 1;
+	}
+	uio->uio_resid = len;
+	uio->uio_offset = 0;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = kreq->ucr_read ? UIO_READ : UIO_WRITE;
+	uio->uio_procp = p;
+}
+
+int ugen_prepare_bulk(struct ugen_softc *sc, struct
+    usb_ctl_request *req, struct usb_ctl_request **kreqp, struct proc *p) {
+	struct usb_ctl_request *kreq;
+	struct usbd_xfer *xfer;
+	int len;
+	void *buf;
+	struct uio uio;
+	struct iovec iov, *kiov = NULL;
+	int error = 0;
+	int flags = 0;
+	struct ugen_endpoint *sce = req->ucr_sce;
+
+	if (req->ucr_iovcnt != 0) {
+		error = ugen_copyin_iov(req, &kiov);
+		if (error)
+			return (error);
+	}
+	len = req->ucr_actlen;
+
+	if (len < 0) /* are bulk transfers of length zero allowed? */
+		return (EINVAL);
+
+	/*
+	 * With USBD_ZERO_COPY the data already is in the mapped pool
+	 * buffer of ucr_slot.  If that buffer can't be used, copy from
+	 * or to ucr_data like any other request.
+	 */
+	if ((req->ucr_flags & USBD_ZERO_COPY) &&
+	    ugen_alloc_slot(sce, req, len, &kreq) == 0) {
+		xfer = kreq->xfer;
+		len = 0;
+	} else {
+		req->ucr_flags &= ~USBD_ZERO_COPY;
+		error = ugen_alloc_request(sc, sce, req, len, &kreq, &buf);
+		if (error) {
+			if (kiov != NULL)
+				free(kiov, M_USBDEV,
+				    req->ucr_iovcnt * sizeof(*kiov));
+			return (error);
+		}
+		xfer = kreq->xfer;
+		kreq->iov = kiov;
+	}
+
+	if (len != 0) {
+		ugen_request_uio(kreq, &uio, &iov, len, p);
 		if (uio.uio_rw == UIO_WRITE) {
 			error = uiomove(buf, len, &uio);
 			if (error) {
-				usbd_free_xfer(xfer);
-				free(kreq, M_TEMP, sizeof(*kreq));
+				ugen_put_request(sce, kreq);
 				return (error);
 			}
 		}
@@ -1146,29 +2610,436 @@ int ugen_submit_bulk(struct ugen_softc *sc, struct
 		flags |= USBD_FORCE_SHORT_XFER;
 	if (kreq->ucr_flags & USBD_SHORT_XFER_OK)
 		flags |= USBD_SHORT_XFER_OK;
-	usbd_setup_xfer(xfer, sce->pipeh, kreq, NULL, len,
+	usbd_setup_xfer(xfer, sce->pipeh, kreq, NULL, kreq->ucr_actlen,
 	    flags | USBD_NO_COPY,
 	    kreq->ucr_timeout, (usbd_callback) ugen_async_callback);
 	kreq->xfer = xfer;
+	*kreqp = kreq;
+	return (0);
+}
+
+/*
+ * Interrupt requests are set up like bulk ones, but an IN transfer
+ * always ends at a short packet so that packet boundaries are kept.
+ */
+int
+ugen_prepare_intr(struct ugen_softc *sc, struct usb_ctl_request *req,
+    struct usb_ctl_request **kreqp, struct proc *p)
+{
+	int error;
+
+	if (req->ucr_read)
+		req->ucr_flags |= USBD_SHORT_XFER_OK;
+	error = ugen_prepare_bulk(sc, req, kreqp, p);
+	if (error == 0)
+		ugen_set_async(req->ucr_sce);
+	return (error);
+}
+
+/*
+ * Isochronous requests carry ucr_nframes frame lengths at ucr_frlengths,
+ * the frames are packed back to back in ucr_data.
+ */
+int
+ugen_prepare_isoc(struct ugen_softc *sc, struct usb_ctl_request *req,
+    struct usb_ctl_request **kreqp, struct proc *p)
+{
+	struct ugen_endpoint *sce = req->ucr_sce;
+	struct usb_ctl_request *kreq;
+	u_int16_t *frlengths;
+	size_t frsize;
+	void *buf;
+	int maxsize, len, i;
+	int error;
+
+	if (req->ucr_nframes <= 0 || req->ucr_nframes > USB_MAX_FRAMES)
+		return (EINVAL);
+	/* High-bandwidth endpoints move up to three packets per frame. */
+	maxsize = UE_GET_SIZE(UGETW(sce->edesc->wMaxPacketSize)) *
+	    (UE_GET_TRANS(UGETW(sce->edesc->wMaxPacketSize)) + 1);
+
+	frsize = req->ucr_nframes * sizeof(*frlengths);
+	frlengths = malloc(frsize, M_USBDEV, M_WAITOK);
+	error = copyin(req->ucr_frlengths, frlengths, frsize);
+	if (error)
+		goto bad;
+	len = 0;
+	for (i = 0; i < req->ucr_nframes; i++) {
+		if (frlengths[i] > maxsize) {
+			error = EINVAL;
+			goto bad;
+		}
+		len += frlengths[i];
+	}
+	if (len == 0) {
+		error = EINVAL;
+		goto bad;
+	}
+
+	req->ucr_flags &= ~USBD_ZERO_COPY;
+	error = ugen_alloc_request(sc, sce, req, len, &kreq, &buf);
+	if (error)
+		goto bad;
+	kreq->ucr_read = UE_GET_DIR(sce->edesc->bEndpointAddress) == UE_DIR_IN;
+	kreq->ucr_actlen = len;
+	kreq->frlengths = frlengths;
+	if (!kreq->ucr_read) {
+		error = copyin(req->ucr_data, buf, len);
+		if (error) {
+			ugen_put_request(sce, kreq);
+			return (error);
+		}
+	}
+
+	ugen_set_async(sce);
+	usbd_setup_isoc_xfer(kreq->xfer, sce->pipeh, kreq, frlengths,
+	    kreq->ucr_nframes, USBD_NO_COPY | USBD_SHORT_XFER_OK,
+	    ugen_async_callback);
+	*kreqp = kreq;
+	return (0);
+
+bad:
+	free(frlengths, M_USBDEV, frsize);
+	return (error);
+}
+
+/*
+ * The first async request on an interrupt or isoc IN endpoint takes its
+ * pipe over from the read(2) path until the endpoint is closed.
+ */
+void
+ugen_set_async(struct ugen_endpoint *sce)
+{
+	int s;
+
+	if (sce->state & UGEN_ASYNC)
+		return;
 	s = splusb();
-	err = usbd_transfer(xfer);
+	sce->state |= UGEN_ASYNC;
+	if (sce->ibuf != NULL)
+		usbd_abort_pipe(sce->pipeh);
+	splx(s);
+}
+
+/*
+ * Get a kernel copy of req with a transfer and a DMA buffer of at
+ * least len bytes, from the endpoint pool when one is available.
+ */
+int
+ugen_alloc_request(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct usb_ctl_request *req, int len, struct usb_ctl_request **kreqp,
+    void **bufp)
+{
+	struct ugen_endpoint *psce = sce->asce;
+	struct usb_ctl_request *kreq = NULL;
+	struct usbd_xfer *xfer;
+	void *buf = NULL;
+
+	if (psce->pool != NULL && !(psce->pool_flags & USB_POOL_MAP)) {
+		rw_enter_write(&psce->pool_lock);
+		if (len <= psce->pool_maxlen &&
+		    (kreq = TAILQ_FIRST(&psce->pool_free)) != NULL) {
+			TAILQ_REMOVE(&psce->pool_free, kreq, entries);
+			psce->pool_nfree--;
+			psce->pool_hits++;
+		} else
+			psce->pool_misses++;
+		rw_exit_write(&psce->pool_lock);
+	}
+	if (kreq != NULL) {
+		xfer = kreq->xfer;
+		*kreq = *req;
+		kreq->xfer = xfer;
+		kreq->frlengths = NULL;
+		kreq->iov = NULL;
+		*kreqp = kreq;
+		*bufp = KERNADDR(&xfer->dmabuf, 0);
+		return (0);
+	}
+
+	kreq = malloc(sizeof(*kreq), M_TEMP, M_WAITOK);
+	if (kreq == NULL)
+		return (ENOMEM);
+	*kreq = *req;
+	kreq->frlengths = NULL;
+	kreq->iov = NULL;
+
+	xfer = usbd_alloc_xfer(sc->sc_udev);
+	if (xfer == NULL) {
+		free(kreq, M_TEMP, sizeof(*kreq));
+		return (ENOMEM);
+	}
+	if (len != 0) {
+		buf = usbd_alloc_buffer(xfer, len);
+		if (buf == NULL) {
+			usbd_free_xfer(xfer);
+			free(kreq, M_TEMP, sizeof(*kreq));
+			return (ENOMEM);
+		}
+	}
+	kreq->xfer = xfer;
+	*kreqp = kreq;
+	*bufp = buf;
+	return (0);
+}
+
+/*
+ * Take the pool request owning buffer ucr_slot of a mapped pool for a
+ * zero-copy transfer.  Fails if the slot is busy or too small.
+ */
+int
+ugen_alloc_slot(struct ugen_endpoint *sce, struct usb_ctl_request *req,
+    int len, struct usb_ctl_request **kreqp)
+{
+	struct ugen_endpoint *psce = sce->asce;
+	struct usb_ctl_request *kreq = NULL;
+	struct usbd_xfer *xfer;
+
+	rw_enter_write(&psce->pool_lock);
+	if (psce->pool != NULL && (psce->pool_flags & USB_POOL_MAP) &&
+	    req->ucr_slot >= 0 && req->ucr_slot < psce->pool_count &&
+	    len <= psce->pool_maxlen &&
+	    psce->pool[req->ucr_slot].ucr_sce == NULL) {
+		kreq = &psce->pool[req->ucr_slot];
+		TAILQ_REMOVE(&psce->pool_free, kreq, entries);
+		psce->pool_nfree--;
+		psce->pool_hits++;
+	} else
+		psce->pool_misses++;
+	rw_exit_write(&psce->pool_lock);
+
+	if (kreq == NULL)
+		return (EINVAL);
+	xfer = kreq->xfer;
+	*kreq = *req;
+	kreq->xfer = xfer;
+	kreq->frlengths = NULL;
+	kreq->iov = NULL;
+	*kreqp = kreq;
+	return (0);
+}
+
+/*
+ * Give a request back to the pool it came from or free it.  The pool
+ * of an endpoint lives on its IN side and is never touched from
+ * interrupt context.
+ */
+void
+ugen_put_request(struct ugen_endpoint *sce, struct usb_ctl_request *kreq)
+{
+	struct ugen_endpoint *psce = sce->asce;
+
+	if (kreq->frlengths != NULL) {
+		free(kreq->frlengths, M_USBDEV,
+		    kreq->ucr_nframes * sizeof(u_int16_t));
+		kreq->frlengths = NULL;
+	}
+	if (kreq->iov != NULL) {
+		free(kreq->iov, M_USBDEV,
+		    kreq->ucr_iovcnt * sizeof(struct iovec));
+		kreq->iov = NULL;
+	}
+	if (UGEN_POOLED(psce, kreq)) {
+		rw_enter_write(&psce->pool_lock);
+		kreq->ucr_sce = NULL;	/* marks the slot free */
+		TAILQ_INSERT_TAIL(&psce->pool_free, kreq, entries);
+		psce->pool_nfree++;
+		rw_exit_write(&psce->pool_lock);
+		return;
+	}
+	usbd_free_xfer(kreq->xfer);
+	free(kreq, M_TEMP, sizeof(*kreq));
+}
+
+/*
+ * Preallocate count requests with a transfer and a maxlen bytes DMA
+ * buffer each, so that submitting and reaping do not allocate.  The
+ * pool can only be replaced when all of its requests are free.  Like
+ * the completion ring, a pool whose buffers have been mapped is only
+ * freed on detach and can only be set up again with the same geometry.
+ */
+int
+ugen_pool_setup(struct ugen_softc *sc, struct ugen_endpoint *sce,
+    struct usb_pool *up)
+{
+	struct usb_ctl_request *pool = NULL, *opool;
+	int count = up->up_count, ocount;
+	int maxlen, error = ENOMEM;
+	int i;
+
+	if (count < 0 || count > USB_POOL_MAXCOUNT)
+		return (EINVAL);
+	if (count > 0 && (up->up_maxlen <= 0 ||
+	    up->up_maxlen > USB_POOL_MAXLEN))
+		return (EINVAL);
+	if (up->up_flags & ~USB_POOL_MAP)
+		return (EINVAL);
+	/* Mapped buffers must not share pages with anything else. */
+	maxlen = up->up_maxlen;
+	if (up->up_flags & USB_POOL_MAP)
+		maxlen = round_page(maxlen);
+	if (sce->pool_mapped) {
+		if (count != sce->pool_count || maxlen != sce->pool_maxlen ||
+		    up->up_flags != sce->pool_flags)
+			return (EBUSY);
+		up->up_maxlen = maxlen;
+		return (0);
+	}
+
+	if (count > 0) {
+		pool = mallocarray(count, sizeof(*pool), M_USBDEV,
+		    M_WAITOK | M_ZERO);
+		for (i = 0; i < count; i++) {
+			pool[i].xfer = usbd_alloc_xfer(sc->sc_udev);
+			if (pool[i].xfer == NULL)
+				goto bad;
+			if (usbd_alloc_buffer(pool[i].xfer, maxlen) == NULL) {
+				i++;
+				goto bad;
+			}
+		}
+	}
+
+	rw_enter_write(&sce->pool_lock);
+	if (sce->pool_nfree != sce->pool_count || sce->pool_mapped) {
+		rw_exit_write(&sce->pool_lock);
+		error = EBUSY;
+		i = count;
+		goto bad;
+	}
+	opool = sce->pool;
+	ocount = sce->pool_count;
+	sce->pool = pool;
+	sce->pool_count = count;
+	sce->pool_maxlen = count > 0 ? maxlen : 0;
+	sce->pool_flags = count > 0 ? up->up_flags : 0;
+	sce->pool_nfree = count;
+	sce->pool_hits = sce->pool_misses = 0;
+	TAILQ_INIT(&sce->pool_free);
+	for (i = 0; i < count; i++)
+		TAILQ_INSERT_TAIL(&sce->pool_free, &pool[i], entries);
+	rw_exit_write(&sce->pool_lock);
+	up->up_maxlen = count > 0 ? maxlen : 0;
+
+	if (opool != NULL) {
+		for (i = 0; i < ocount; i++)
+			usbd_free_xfer(opool[i].xfer);
+		free(opool, M_USBDEV, ocount * sizeof(*opool));
+	}
+	return (0);
+
+bad:
+	while (--i >= 0) /* implicit buffer free */
+		usbd_free_xfer(pool[i].xfer);
+	free(pool, M_USBDEV, count * sizeof(*pool));
+	return (error);
+}
+
+void
+ugen_pool_destroy(struct ugen_endpoint *sce)
+{
+	int i;
+
+	if (sce->pool == NULL || sce->pool_mapped)
+		return;
+	if (sce->pool_nfree != sce->pool_count) {
+		/* Requests still in flight, leak rather than corrupt. */
+		printf("ugen_pool_destroy: %d requests busy\n",
+		    sce->pool_count - sce->pool_nfree);
+	} else {
+		for (i = 0; i < sce->pool_count; i++)
+			usbd_free_xfer(sce->pool[i].xfer);
+		free(sce->pool, M_USBDEV,
+		    sce->pool_count * sizeof(*sce->pool));
+	}
+	sce->pool = NULL;
+	sce->pool_count = sce->pool_nfree = 0;
+}
+
+/*
+ * Allocate and set up the kernel copy of an async request for the
+ * transfer type of the endpoint.  The transfer is not started.
+ */
+int
+ugen_prepare_request(struct ugen_softc *sc, int endpt,
+    struct usb_ctl_request *req, struct usb_ctl_request **kreqp,
+    struct proc *p)
+{
+	struct ugen_endpoint *sce = req->ucr_sce;
+
+	if (endpt == USB_CONTROL_ENDPOINT)
+		return (ugen_prepare_ctrl(sc, req, kreqp, p));
+
+	if (!sce->edesc || sce->pipeh == NULL) {
+		printf("ugenioctl: no edesc\n");
+		return (EINVAL);
+	}
+	switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
+	case UE_BULK:
+		if (sce->state & (UGEN_RA | UGEN_WB | UGEN_SETUP))
+			return (EBUSY);
+		return (ugen_prepare_bulk(sc, req, kreqp, p));
+	case UE_INTERRUPT:
+		return (ugen_prepare_intr(sc, req, kreqp, p));
+	case UE_ISOCHRONOUS:
+		return (ugen_prepare_isoc(sc, req, kreqp, p));
+	default:
+		return (EINVAL);
+	}
+}
+
+/*
+ * Abort every request in flight on an endpoint; their callbacks move
+ * them to the complete queue.  A private pipe is aborted as a whole,
+ * requests on the shared default pipe one by one.  Must be called at
+ * splusb.
+ */
+void
+ugen_abort_requests(struct ugen_endpoint *sce, int endpt)
+{
+	struct usb_ctl_request *req, *nreq;
+
+	if (endpt == USB_CONTROL_ENDPOINT) {
+		TAILQ_FOREACH_SAFE(req, &sce->submit_queue, entries, nreq)
+			usbd_abort_transfer(req->xfer);
+	} else if (sce->pipeh != NULL && !TAILQ_EMPTY(&sce->submit_queue))
+		usbd_abort_pipe(sce->pipeh);
+}
+
+/*
+ * Start a prepared request and put it on the submit queue.  Must be
+ * called at splusb with the endpoint queue lock held.  On failure the
+ * request is freed.
+ */
+int
+ugen_start_request(struct ugen_endpoint *sce, struct usb_ctl_request *kreq)
+{
+	usbd_status err;
+	int error;
+
+	if (sce->cq == NULL || sce->cq_reserved >= UGEN_CQSIZE) {
+		ugen_put_request(sce, kreq);
+		return (ENOBUFS);
+	}
+	nanouptime(&kreq->start);
+	err = usbd_transfer(kreq->xfer);
 	if (err != USBD_IN_PROGRESS) {
-		splx(s);
-		usbd_clear_endpoint_stall(sce->pipeh);
+		if (sce->pipeh != NULL)
+			usbd_clear_endpoint_stall_async(sce->pipeh);
 		if (err == USBD_INTERRUPTED)
 			error = EINTR;
 		else if (err == USBD_TIMEOUT)
 			error = ETIMEDOUT;
 		else
 			error = EIO;
-		usbd_free_xfer(xfer);
-		free(kreq, M_TEMP, sizeof(*kreq));
+		ugen_put_request(sce, kreq);
 		return (error);
 	}
-	rw_enter_write(&q_lock);
 	TAILQ_INSERT_TAIL(&sce->submit_queue, kreq, entries);
-	rw_exit_write(&q_lock);
-	splx(s);
+	LIST_INSERT_HEAD(UGEN_CTX_HASH(sce, kreq->ucr_context), kreq,
+	    hash_entries);
+	sce->cq_reserved++;
+	sce->stats.ues_submitted++;
 	return (0);
 }
 
@@ -1181,10 +3052,8 @@ int ugen_complete_ctrl(struct usb_ctl_request *req, struct
 	int error = 0;
 
 	xfer = req->xfer;
-	if (req->ucr_status == USBD_CANCELLED) {
-		usbd_free_xfer(xfer);
+	if (req->ucr_status == USBD_CANCELLED)
 		return (0);
-	}
 	req->ucr_status = xfer->status;
 	if (xfer->status == USBD_NORMAL_COMPLETION) {
 		len = UGETW(req->ucr_request.wLength);
@@ -1205,15 +3074,11 @@ int ugen_complete_ctrl(struct usb_ctl_request *req, struct
 			uio.uio_procp = p;
 			if (uio.uio_rw == UIO_READ) {
 				error = uiomove(KERNADDR(&xfer->dmabuf, 0), len, &uio);
-				if (error) {
+				if (error)
 					req->ucr_status = USBD_IOERROR;
-					usbd_free_xfer(xfer);
-					return (0);
-				}
 			}
 		}
 	}
-	usbd_free_xfer(xfer);
 	return (0);
 }
 
@@ -1226,42 +3091,98 @@ int ugen_complete_bulk(struct usb_ctl_request *req, struct
 	int error = 0;
 
 	xfer = req->xfer;
-	if (req->ucr_status == USBD_CANCELLED) {
-		usbd_free_xfer(xfer);
+	if (req->ucr_status == USBD_CANCELLED)
 		return (0);
-	}
 	req->ucr_status = xfer->status;
 	if (xfer->status == USBD_NORMAL_COMPLETION) {
 		len = req->ucr_actlen;
 		if (len > xfer->actlen)
 			len = xfer->actlen;
 		req->ucr_actlen = len;
-		if (len != 0) {
-			iov.iov_base = (caddr_t)req->ucr_data;
-			iov.iov_len = len;
-			uio.uio_iov = &iov;
-			uio.uio_iovcnt = 1;
-			uio.uio_resid = len;
-			uio.uio_offset = 0;
-			uio.uio_segflg = UIO_USERSPACE;
-			uio.uio_rw =
-				req->ucr_read ?
-				UIO_READ : UIO_WRITE;
-			uio.uio_procp = p;
+		if (len != 0 && !(req->ucr_flags & USBD_ZERO_COPY)) {
+			ugen_request_uio(req, &uio, &iov, len, p);
 			if (uio.uio_rw == UIO_READ) {
 				error = uiomove(KERNADDR(&xfer->dmabuf, 0), len, &uio);
-				if (error) {
+				if (error)
 					req->ucr_status = USBD_IOERROR;
-					usbd_free_xfer(xfer);
-					return (0);
-				}
 			}
 		}
 	}
-	usbd_free_xfer(xfer);
 	return (0);
 }
 
+/*
+ * The host controller leaves the data of each frame at its requested
+ * offset and replaces the frame lengths with the actual ones.
+ */
+int
+ugen_complete_isoc(struct usb_ctl_request *req, struct proc *p)
+{
+	struct usbd_xfer *xfer = req->xfer;
+	int len, error;
+
+	if (req->ucr_status == USBD_CANCELLED)
+		return (0);
+	req->ucr_status = xfer->status;
+	if (xfer->status != USBD_NORMAL_COMPLETION)
+		return (0);
+	len = req->ucr_actlen;
+	req->ucr_actlen = xfer->actlen;
+	error = copyout(req->frlengths, req->ucr_frlengths,
+	    req->ucr_nframes * sizeof(u_int16_t));
+	if (error == 0 && req->ucr_read && len != 0)
+		error = copyout(KERNADDR(&xfer->dmabuf, 0), req->ucr_data, len);
+	if (error)
+		req->ucr_status = USBD_IOERROR;
+	return (0);
+}
+
+/*
+ * Finish a request taken off the complete queue: copy the data out.
+ * Releasing the request is left to the caller.
+ */
+int
+ugen_finish_request(struct ugen_softc *sc, int endpt,
+    struct usb_ctl_request *kreq, struct proc *p)
+{
+	struct ugen_endpoint *sce = kreq->ucr_sce;
+
+	if (endpt == USB_CONTROL_ENDPOINT)
+		return (ugen_complete_ctrl(kreq, p));
+
+	if (!sce->edesc) {
+		printf("ugenioctl: no edesc\n");
+		return (EINVAL);
+	}
+	switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
+	case UE_BULK:
+	case UE_INTERRUPT:
+		return (ugen_complete_bulk(kreq, p));
+	case UE_ISOCHRONOUS:
+		return (ugen_complete_isoc(kreq, p));
+	default:
+		return (EINVAL);
+	}
+}
+
+/*
+ * Copy a finished request for userland, without the kernel's own
+ * pointers and list linkage.
+ */
+void
+ugen_export_request(struct usb_ctl_request *ureq,
+    struct usb_ctl_request *kreq)
+{
+	*ureq = *kreq;
+	ureq->ucr_sce = NULL;
+	ureq->xfer = NULL;
+	ureq->frlengths = NULL;
+	ureq->iov = NULL;
+	timespecclear(&ureq->start);
+	memset(&ureq->entries, 0, sizeof(ureq->entries));
+	memset(&ureq->hash_entries, 0, sizeof(ureq->hash_entries));
+}
+
 int
 ugen_do_ioctl(struct ugen_softc *sc, int endpt, u_long cmd, caddr_t addr,
     int flag, struct proc *p)
@@ -1309,131 +3230,326 @@ ugen_do_ioctl(struct ugen_softc *sc, int endpt, u_long cmd, caddr_t addr,
 			return (EINVAL);
 		sce->timeout = *(int *)addr;
 		return (0);
+	case USB_SET_BUFSIZE:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		return (ugen_set_bsize(sc, endpt, *(int *)addr));
+	case USB_GET_BUFSIZE:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		sce = &sc->sc_endpoints[endpt][IN];
+		if (sce->pipeh == NULL)
+			sce = &sc->sc_endpoints[endpt][OUT];
+		*(int *)addr = sce->bsize;
+		return (0);
+	case USB_SET_BULK_RA:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		return (ugen_bulkra_start(sc, &sc->sc_endpoints[endpt][IN],
+		    (struct usb_bulk_ra *)addr));
+	case USB_SET_INTR_RING:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		return (ugen_intr_ring(&sc->sc_endpoints[endpt][IN],
+		    (struct usb_intr_ring *)addr));
+	case USB_GET_INTR_RING:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		sce = &sc->sc_endpoints[endpt][IN];
+		if (sce->ipkts == NULL)
+			return (EINVAL);
+		ugen_intr_ring_status(sce, (struct usb_intr_ring *)addr);
+		return (0);
+	case USB_SET_ISOC_GEOMETRY:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		return (ugen_isoc_geometry(&sc->sc_endpoints[endpt][IN],
+		    (struct usb_isoc_geometry *)addr));
+	case USB_SET_BULK_WB:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		return (ugen_bulkwb_start(sc, &sc->sc_endpoints[endpt][OUT],
+		    (struct usb_bulk_wb *)addr));
+	case USB_BULK_WB_DRAIN:
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		sce = &sc->sc_endpoints[endpt][OUT];
+		if (!(sce->state & UGEN_WB))
+			return (0);
+		return (ugen_bulkwb_drain(sc, sce));
+	case USB_GET_BULK_RA:
+	{
+		struct usb_bulk_ra *ubr = (void *)addr;
+		int s;
+
+		if (endpt == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		sce = &sc->sc_endpoints[endpt][IN];
+		memset(ubr, 0, sizeof(*ubr));
+		if (!(sce->state & UGEN_RA))
+			return (0);
+		s = splusb();
+		ubr->ubr_xfersize = sce->ra_xfersize;
+		ubr->ubr_depth = sce->nraxfers;
+		ubr->ubr_bufsize = sce->limit - sce->ibuf;
+		ubr->ubr_inflight = sce->ra_inflight;
+		ubr->ubr_overruns = sce->ra_overruns;
+		splx(s);
+		return (0);
+	}
 	case USB_DO_REQUEST:
 	{
 		struct usb_ctl_request *req = (void *)addr;
+		struct usb_ctl_request *kreq;
 		int error = 0;
+		int s;
 
-		sce = &sc->sc_endpoints[endpt][IN];
+		sce = ugen_async_sce(sc, endpt, req);
 		req->ucr_sce = sce;
 
-		if (endpt == USB_CONTROL_ENDPOINT) {
-			if (!(flag & FWRITE))
-				return (EPERM);
-			error = ugen_submit_ctrl(sc, req, p);
-			if (error)
-				return (error);
-		} else {
-			if (!sce->edesc) {
-				printf("ugenioctl: no edesc\n");
-				return (EINVAL);
-			}
-			switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
-			case UE_INTERRUPT:
-			case UE_ISOCHRONOUS:
-				return (EINVAL);
-			case UE_BULK:
-				error = ugen_submit_bulk(sc, req, p);
-				if (error)
-					return (error);
-				break;
-			default:
-				return (EINVAL);
+		if (endpt == USB_CONTROL_ENDPOINT && !(flag & FWRITE))
+			return (EPERM);
+		ugen_cring_reclaim(sce);
+		if ((error = ugen_cq_init(sce)) != 0)
+			return (error);
+		error = ugen_prepare_request(sc, endpt, req, &kreq, p);
+		if (error)
+			return (error);
+
+		s = splusb();
+		rw_enter_write(&sce->q_lock);
+		error = ugen_start_request(sce, kreq);
+		rw_exit_write(&sce->q_lock);
+		splx(s);
+		return (error);
+	}
+	case USB_DO_REQUESTS:
+	{
+		struct usb_ctl_requests *ucrs = (void *)addr;
+		struct usb_ctl_request *reqs, **kreqs;
+		int *errors;
+		int count = ucrs->ucrs_count;
+		int error = 0;
+		int i, s, dir;
+
+		if (endpt == USB_CONTROL_ENDPOINT && !(flag & FWRITE))
+			return (EPERM);
+		if (count <= 0 || count > USB_MAX_REQUESTS)
+			return (EINVAL);
+
+		reqs = mallocarray(count, sizeof(*reqs), M_TEMP, M_WAITOK);
+		kreqs = mallocarray(count, sizeof(*kreqs), M_TEMP,
+		    M_WAITOK | M_ZERO);
+		errors = mallocarray(count, sizeof(*errors), M_TEMP, M_WAITOK);
+		error = copyin(ucrs->ucrs_reqs, reqs, count * sizeof(*reqs));
+		if (error)
+			goto batch_out;
+
+		/* Do everything that may sleep before raising spl. */
+		ugen_cring_reclaim(&sc->sc_endpoints[endpt][IN]);
+		ugen_cring_reclaim(&sc->sc_endpoints[endpt][OUT]);
+		for (i = 0; i < count; i++) {
+			sce = ugen_async_sce(sc, endpt, &reqs[i]);
+			reqs[i].ucr_sce = sce;
+			errors[i] = ugen_cq_init(sce);
+			if (errors[i] == 0)
+				errors[i] = ugen_prepare_request(sc, endpt,
+				    &reqs[i], &kreqs[i], p);
+		}
+
+		/*
+		 * Once a request is started the ioctl has to succeed for
+		 * ucrs_done to reach userland, so make sure the errors
+		 * can be copied out first.
+		 */
+		error = copyout(errors, ucrs->ucrs_errors,
+		    count * sizeof(*errors));
+		if (error) {
+			for (i = 0; i < count; i++)
+				if (errors[i] == 0)
+					ugen_put_request(reqs[i].ucr_sce,
+					    kreqs[i]);
+			goto batch_out;
+		}
+
+		/* Start the requests of each side under one lock. */
+		ucrs->ucrs_done = 0;
+		s = splusb();
+		for (dir = OUT; dir <= IN; dir++) {
+			sce = &sc->sc_endpoints[endpt][dir];
+			rw_enter_write(&sce->q_lock);
+			for (i = 0; i < count; i++) {
+				if (errors[i] || reqs[i].ucr_sce != sce)
+					continue;
+				errors[i] = ugen_start_request(sce, kreqs[i]);
+				if (errors[i] == 0)
+					ucrs->ucrs_done++;
 			}
+			rw_exit_write(&sce->q_lock);
 		}
-		return (0);
+		splx(s);
+
+		(void)copyout(errors, ucrs->ucrs_errors,
+		    count * sizeof(*errors));
+batch_out:
+		free(errors, M_TEMP, count * sizeof(*errors));
+		free(kreqs, M_TEMP, count * sizeof(*kreqs));
+		free(reqs, M_TEMP, count * sizeof(*reqs));
+		return (error);
 	}
 	case USB_GET_COMPLETED:
 	{
 
 		struct usb_ctl_request *req = (void *)addr;
 		struct usb_ctl_request *kreq;
-		int s;
 		int error = 0;
 
-		sce = &sc->sc_endpoints[endpt][IN];
-
-		s = splusb();
-		rw_enter_write(&q_lock);
-		kreq = TAILQ_FIRST(&sce->complete_queue);
-		if (kreq == NULL) {
-			rw_exit_write(&q_lock);
-			splx(s);
+		if (ugen_reap(sc, endpt, &kreq, 1) == 0)
 			return (EIO);
-		}
-		TAILQ_REMOVE(&sce->complete_queue, kreq, entries);
-		rw_exit_write(&q_lock);
-		splx(s);
 
-		if (endpt == USB_CONTROL_ENDPOINT) {
-			error = ugen_complete_ctrl(kreq, p);
-			if (error)
-				return (error);
-		} else {
-			if (!sce->edesc) {
-				printf("ugenioctl: no edesc\n");
-				return (EINVAL);
-			}
-			switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
-			case UE_INTERRUPT:
-			case UE_ISOCHRONOUS:
-				return (EINVAL);
-			case UE_BULK:
-				error = ugen_complete_bulk(kreq, p);
-				if (error)
-					return (error);
-				break;
-			default:
-				return (EINVAL);
-			}
+		error = ugen_finish_request(sc, endpt, kreq, p);
+		if (error == 0)
+			ugen_export_request(req, kreq);
+		ugen_put_request(kreq->ucr_sce, kreq);
+		return (error);
+	}
+	case USB_GET_COMPLETIONS:
+	{
+		struct usb_ctl_requests *ucrs = (void *)addr;
+		struct usb_ctl_request *kreq, **kreqs, *done;
+		int count = ucrs->ucrs_count;
+		int error;
+		int i, n;
+
+		if (count <= 0 || count > USB_MAX_REQUESTS)
+			return (EINVAL);
+
+		kreqs = mallocarray(count, sizeof(*kreqs), M_TEMP, M_WAITOK);
+		done = mallocarray(count, sizeof(*done), M_TEMP,
+		    M_WAITOK | M_ZERO);
+		/*
+		 * Reaped requests cannot be put back, so make sure they
+		 * can be copied out before taking any.
+		 */
+		error = copyout(done, ucrs->ucrs_reqs, count * sizeof(*done));
+		if (error)
+			goto reap_out;
+		n = ugen_reap(sc, endpt, kreqs, count);
+
+		ucrs->ucrs_done = 0;
+		for (i = 0; i < n; i++) {
+			kreq = kreqs[i];
+			if (ugen_finish_request(sc, endpt, kreq, p) == 0)
+				ugen_export_request(&done[ucrs->ucrs_done++],
+				    kreq);
+			ugen_put_request(kreq->ucr_sce, kreq);
 		}
+		(void)copyout(done, ucrs->ucrs_reqs,
+		    ucrs->ucrs_done * sizeof(*done));
+reap_out:
+		free(done, M_TEMP, count * sizeof(*done));
+		free(kreqs, M_TEMP, count * sizeof(*kreqs));
+		return (error);
+	}
+	case USB_SET_POOL:
+		sce = &sc->sc_endpoints[endpt][IN];
+		return (ugen_pool_setup(sc, sce, (struct usb_pool *)addr));
+	case USB_GET_POOL:
+	{
+		struct usb_pool *up = (void *)addr;
 
-		*req = *kreq;
-		free(kreq, M_TEMP, sizeof(*kreq));
+		sce = &sc->sc_endpoints[endpt][IN];
+		rw_enter_read(&sce->pool_lock);
+		up->up_count = sce->pool_count;
+		up->up_maxlen = sce->pool_maxlen;
+		up->up_flags = sce->pool_flags;
+		up->up_free = sce->pool_nfree;
+		up->up_hits = sce->pool_hits;
+		up->up_misses = sce->pool_misses;
+		rw_exit_read(&sce->pool_lock);
 		return (0);
 	}
-	case USB_CANCEL:
+	case USB_SET_CRING:
+		return (ugen_cring_setup(sc, endpt,
+		    (struct usb_cring_setup *)addr));
+	case USB_SET_COALESCE:
 	{
-		struct usb_ctl_request *req = (void *)addr;
-		struct usb_ctl_request *kreq;
-		struct usb_ctl_request *np;
-		int s;
+		struct usb_async_coalesce *uac = (void *)addr;
+		int error;
+
+		error = ugen_set_coalesce(&sc->sc_endpoints[endpt][IN], uac);
+		if (error == 0)
+			error = ugen_set_coalesce(&sc->sc_endpoints[endpt][OUT],
+			    uac);
+		return (error);
+	}
+	case USB_GET_STATS:
+		ugen_get_stats(sc, endpt, (struct usb_endpoint_stats *)addr);
+		return (0);
+	case USB_GET_COALESCE:
+	{
+		struct usb_async_coalesce *uac = (void *)addr;
 
 		sce = &sc->sc_endpoints[endpt][IN];
+		uac->uac_count = sce->coalesce_count;
+		uac->uac_usec = sce->coalesce_usec;
+		return (0);
+	}
+	case USB_CANCEL:
+	{
+		struct usb_ctl_request *req = (void *)addr;
+		struct usb_ctl_request *kreq = NULL;
+		int dir, s;
 
 		s = splusb();
-		rw_enter_write(&q_lock);
-		kreq = NULL;
-		TAILQ_FOREACH(np, &sce->submit_queue, entries) {
-			if (np->ucr_context == req->ucr_context) {
-				kreq = np;
-				break;
+		for (dir = IN; dir >= OUT && kreq == NULL; dir--) {
+			sce = &sc->sc_endpoints[endpt][dir];
+			rw_enter_write(&sce->q_lock);
+			LIST_FOREACH(kreq, UGEN_CTX_HASH(sce,
+			    req->ucr_context), hash_entries) {
+				if (kreq->ucr_context == req->ucr_context)
+					break;
 			}
+			if (kreq == NULL)
+				rw_exit_write(&sce->q_lock);
 		}
 		if (kreq == NULL) {
-			TAILQ_FOREACH(np, &sce->complete_queue, entries) {
-				if (np->ucr_context == req->ucr_context) {
-					kreq = np;
-					break;
-				}
-			}
-			if (kreq == NULL) {
-				/* error, neither completed
-				 * nor submitted */
-				rw_exit_write(&q_lock);
-				splx(s);
-				return (EINVAL);
-			} else {
-				kreq->ucr_status = USBD_CANCELLED;
-			}
-		} else {
-			usbd_abort_transfer(kreq->xfer);
-			//kreq->ucr_status = USBD_CANCELLED;
+			/* error, neither completed nor submitted */
+			splx(s);
+			return (EINVAL);
 		}
-		rw_exit_write(&q_lock);
+		/* Still in flight if the transfer has no final status. */
+		if (kreq->xfer->status == USBD_IN_PROGRESS)
+			usbd_abort_transfer(kreq->xfer);
+		else
+			kreq->ucr_status = USBD_CANCELLED;
+		rw_exit_write(&sce->q_lock);
 		splx(s);
 		return (0);
 	}
+	case USB_CANCEL_ALL:
+	{
+		u_int i, head;
+		int dir, s;
+
+		for (dir = OUT; dir <= IN; dir++) {
+			sce = &sc->sc_endpoints[endpt][dir];
+			rw_enter_write(&sce->cq_lock);
+			s = splusb();
+			rw_enter_write(&sce->q_lock);
+			ugen_abort_requests(sce, endpt);
+			rw_exit_write(&sce->q_lock);
+			splx(s);
+			/* Slots up to head are ours until cq_tail passes. */
+			head = sce->cq_head;
+			membar_consumer();
+			for (i = sce->cq_tail; i != head; i++)
+				sce->cq[i & (UGEN_CQSIZE - 1)]->ucr_status =
+				    USBD_CANCELLED;
+			rw_exit_write(&sce->cq_lock);
+		}
+		return (0);
+	}
 	default:
 		break;
 	}
@@ -1619,7 +3735,7 @@ int
 ugenpoll(dev_t dev, int events, struct proc *p)
 {
 	struct ugen_softc *sc;
-	struct ugen_endpoint *sce;
+	struct ugen_endpoint *sce, *sceo;
 	int revents = 0;
 	int s;
 
@@ -1628,10 +3744,13 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 	if (usbd_is_dying(sc->sc_udev))
 		return (POLLERR);
 
-	/* XXX always IN */
+	/* XXX always IN, unless the endpoint is write-only */
 	sce = &sc->sc_endpoints[UGENENDPOINT(dev)][IN];
 	if (sce == NULL)
 		return (POLLERR);
+	sceo = &sc->sc_endpoints[UGENENDPOINT(dev)][OUT];
+	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT && sce->edesc == NULL)
+		sce = sceo;
 #ifdef DIAGNOSTIC
 	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT) {
 		if (!sce->edesc) {
@@ -1644,11 +3763,15 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 		}
 	}
 #endif
+	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT && sce != sceo &&
+	    (sce->edesc->bmAttributes & UE_XFERTYPE) == UE_ISOCHRONOUS &&
+	    (events & (POLLIN | POLLRDNORM)) && ugen_isoc_start(sc, sce))
+		return (POLLERR);
 	s = splusb();
-	rw_enter_write(&q_lock);
+	rw_enter_write(&sce->q_lock);
 	if (UGENENDPOINT(dev) == USB_CONTROL_ENDPOINT) {
 		if (events & (POLLIN | POLLRDNORM)) {
-			if (!TAILQ_EMPTY(&sce->complete_queue))
+			if (ugen_async_pending(sce) > 0)
 				revents |= events & (POLLIN | POLLRDNORM);
 			else
 				selrecord(p, &sce->rsel);
@@ -1657,7 +3780,9 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 		switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 		case UE_INTERRUPT:
 			if (events & (POLLIN | POLLRDNORM)) {
-				if (sce->q.c_cc > 0)
+				if (sce->state & UGEN_ASYNC ?
+				    ugen_async_pending(sce) > 0 :
+				    sce->ipkt_head != sce->ipkt_tail)
 					revents |= events & (POLLIN | POLLRDNORM);
 				else
 					selrecord(p, &sce->rsel);
@@ -1665,7 +3790,9 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 			break;
 		case UE_ISOCHRONOUS:
 			if (events & (POLLIN | POLLRDNORM)) {
-				if (sce->cur != sce->fill)
+				if (sce->state & UGEN_ASYNC ?
+				    ugen_async_pending(sce) > 0 :
+				    sce->cur != sce->fill)
 					revents |= events & (POLLIN | POLLRDNORM);
 				else
 					selrecord(p, &sce->rsel);
@@ -1673,7 +3800,10 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 			break;
 		case UE_BULK:
 			if (events & (POLLIN | POLLRDNORM)) {
-				if (!TAILQ_EMPTY(&sce->complete_queue))
+				if (sce->state & UGEN_RA ?
+				    sce->cur != sce->fill ||
+				    sce->ra_inflight == 0 :
+				    ugen_async_pending(sce) > 0)
 					revents |= events & (POLLIN | POLLRDNORM);
 				else
 					selrecord(p, &sce->rsel);
@@ -1683,14 +3813,67 @@ ugenpoll(dev_t dev, int events, struct proc *p)
 			break;
 		}
 	}
-	rw_exit_write(&q_lock);
+	/*
+	 * OUT requests complete on their own side, so a writer waits
+	 * there for one of its requests to finish.
+	 */
+	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT &&
+	    sceo->edesc != NULL && (events & (POLLOUT | POLLWRNORM))) {
+		if (sceo->state & UGEN_WB ?
+		    UGEN_RING_SPACE(sceo) > 0 || sceo->wb_error :
+		    ugen_cq_pending(sceo) > 0 || sceo->cq_reserved == 0)
+			revents |= events & (POLLOUT | POLLWRNORM);
+		else
+			selrecord(p, &sceo->rsel);
+	}
+	rw_exit_write(&sce->q_lock);
 	splx(s);
 	return (revents);
 }
 
+paddr_t
+ugenmmap(dev_t dev, off_t off, int prot)
+{
+	struct ugen_softc *sc;
+	struct ugen_endpoint *sce;
+	struct usbd_xfer *xfer;
+	vaddr_t va;
+	paddr_t pa;
+
+	sc = ugen_cd.cd_devs[UGENUNIT(dev)];
+
+	if (usbd_is_dying(sc->sc_udev))
+		return (-1);
+
+	/* The completion ring and the pool always live on the IN side. */
+	sce = &sc->sc_endpoints[UGENENDPOINT(dev)][IN];
+	if (off < 0)
+		return (-1);
+	if (off >= USB_POOL_MAPOFF) {
+		off -= USB_POOL_MAPOFF;
+		if (sce->pool == NULL || !(sce->pool_flags & USB_POOL_MAP) ||
+		    off / sce->pool_maxlen >= sce->pool_count)
+			return (-1);
+		sce->pool_mapped = 1;
+		xfer = sce->pool[off / sce->pool_maxlen].xfer;
+		va = (vaddr_t)KERNADDR(&xfer->dmabuf, off % sce->pool_maxlen);
+	} else {
+		if (sce->cring == NULL || off >= sce->cring_len)
+			return (-1);
+		sce->cring_mapped = 1;
+		va = (vaddr_t)sce->cring + off;
+	}
+	if (!pmap_extract(pmap_kernel(), va, &pa))
+		return (-1);
+	return (pa);
+}
+
 void filt_ugenrdetach(struct knote *);
 int filt_ugenread_intr(struct knote *, long);
 int filt_ugenread_isoc(struct knote *, long);
+int filt_ugenread_async(struct knote *, long);
+int filt_ugenwrite_wb(struct knote *, long);
+int filt_ugenwrite_async(struct knote *, long);
 int ugenkqfilter(dev_t, struct knote *);
 
 void
@@ -1709,7 +3892,9 @@ filt_ugenread_intr(struct knote *kn, long hint)
 {
 	struct ugen_endpoint *sce = (void *)kn->kn_hook;
 
-	kn->kn_data = sce->q.c_cc;
+	if (sce->state & UGEN_ASYNC)
+		return (filt_ugenread_async(kn, hint));
+	kn->kn_data = sce->ipkt_head - sce->ipkt_tail;
 	return (kn->kn_data > 0);
 }
 
@@ -1718,8 +3903,13 @@ filt_ugenread_isoc(struct knote *kn, long hint)
 {
 	struct ugen_endpoint *sce = (void *)kn->kn_hook;
 
+	if (sce->state & UGEN_ASYNC)
+		return (filt_ugenread_async(kn, hint));
+	/* All read-ahead transfers have failed, read(2) returns EIO. */
+	if ((sce->state & UGEN_RA) && sce->ra_inflight == 0)
+		kn->kn_flags |= EV_EOF;
 	if (sce->cur == sce->fill)
-		return (0);
+		return ((kn->kn_flags & EV_EOF) != 0);
 
 	if (sce->cur < sce->fill)
 		kn->kn_data = sce->fill - sce->cur;
@@ -1730,14 +3920,62 @@ filt_ugenread_isoc(struct knote *kn, long hint)
 	return (1);
 }
 
+/*
+ * Async requests: report the number of completions waiting on both
+ * sides and in the shared ring.
+ */
+int
+filt_ugenread_async(struct knote *kn, long hint)
+{
+	struct ugen_endpoint *sce = (void *)kn->kn_hook;
+
+	if (sce->state & UGEN_RA)
+		return (filt_ugenread_isoc(kn, hint));
+	kn->kn_data = ugen_async_pending(sce);
+	return (kn->kn_data > 0);
+}
+
+/*
+ * Bulk write-behind: report the free space in the ring.
+ */
+int
+filt_ugenwrite_wb(struct knote *kn, long hint)
+{
+	struct ugen_endpoint *sce = (void *)kn->kn_hook;
+
+	kn->kn_data = UGEN_RING_SPACE(sce);
+	return (kn->kn_data > 0 || sce->wb_error);
+}
+
+/*
+ * Async OUT requests: report the number of completions waiting on the
+ * OUT side.  Also writable while nothing is in flight.
+ */
+int
+filt_ugenwrite_async(struct knote *kn, long hint)
+{
+	struct ugen_endpoint *sce = (void *)kn->kn_hook;
+
+	if (sce->state & UGEN_WB)
+		return (filt_ugenwrite_wb(kn, hint));
+	kn->kn_data = ugen_cq_pending(sce);
+	return (kn->kn_data > 0 || sce->cq_reserved == 0);
+}
+
 struct filterops ugenread_intr_filtops =
 	{ 1, NULL, filt_ugenrdetach, filt_ugenread_intr };
 
 struct filterops ugenread_isoc_filtops =
 	{ 1, NULL, filt_ugenrdetach, filt_ugenread_isoc };
 
-struct filterops ugen_seltrue_filtops =
-	{ 1, NULL, filt_ugenrdetach, filt_seltrue };
+struct filterops ugenread_async_filtops =
+	{ 1, NULL, filt_ugenrdetach, filt_ugenread_async };
+
+struct filterops ugenwrite_wb_filtops =
+	{ 1, NULL, filt_ugenrdetach, filt_ugenwrite_wb };
+
+struct filterops ugenwrite_async_filtops =
+	{ 1, NULL, filt_ugenrdetach, filt_ugenwrite_async };
 
 int
 ugenkqfilter(dev_t dev, struct knote *kn)
@@ -1745,35 +3983,41 @@ ugenkqfilter(dev_t dev, struct knote *kn)
 	struct ugen_softc *sc;
 	struct ugen_endpoint *sce;
 	struct klist *klist;
-	int s;
+	int s, error;
 
 	sc = ugen_cd.cd_devs[UGENUNIT(dev)];
 
 	if (usbd_is_dying(sc->sc_udev))
 		return (ENXIO);
 
-	/* XXX always IN */
+	/* XXX always IN, unless the endpoint is write-only */
 	sce = &sc->sc_endpoints[UGENENDPOINT(dev)][IN];
 	if (sce == NULL)
 		return (EINVAL);
+	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT && sce->edesc == NULL)
+		sce = &sc->sc_endpoints[UGENENDPOINT(dev)][OUT];
+	if (UGENENDPOINT(dev) != USB_CONTROL_ENDPOINT && sce->edesc == NULL)
+		return (EINVAL);
 
 	switch (kn->kn_filter) {
 	case EVFILT_READ:
 		klist = &sce->rsel.si_note;
+		if (UGENENDPOINT(dev) == USB_CONTROL_ENDPOINT) {
+			kn->kn_fop = &ugenread_async_filtops;
+			break;
+		}
 		switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 		case UE_INTERRUPT:
 			kn->kn_fop = &ugenread_intr_filtops;
 			break;
 		case UE_ISOCHRONOUS:
+			if (UE_GET_DIR(sce->edesc->bEndpointAddress) ==
+			    UE_DIR_IN && (error = ugen_isoc_start(sc, sce)))
+				return (error);
 			kn->kn_fop = &ugenread_isoc_filtops;
 			break;
 		case UE_BULK:
-			/* 
-			 * We have no easy way of determining if a read will
-			 * yield any data or a write will happen.
-			 * So, emulate "seltrue".
-			 */
-			kn->kn_fop = &ugen_seltrue_filtops;
+			kn->kn_fop = &ugenread_async_filtops;
 			break;
 		default:
 			return (EINVAL);
@@ -1781,20 +4025,18 @@ ugenkqfilter(dev_t dev, struct knote *kn)
 		break;
 
 	case EVFILT_WRITE:
+		if (UGENENDPOINT(dev) == USB_CONTROL_ENDPOINT)
+			return (EINVAL);
+		sce = &sc->sc_endpoints[UGENENDPOINT(dev)][OUT];
+		if (sce->edesc == NULL)
+			return (EINVAL);
 		klist = &sce->rsel.si_note;
 		switch (sce->edesc->bmAttributes & UE_XFERTYPE) {
 		case UE_INTERRUPT:
 		case UE_ISOCHRONOUS:
-			/* XXX poll doesn't support this */
-			return (EINVAL);
-
 		case UE_BULK:
-			/*
-			 * We have no easy way of determining if a read will
-			 * yield any data or a write will happen.
-			 * So, emulate "seltrue".
-			 */
-			kn->kn_fop = &ugen_seltrue_filtops;
+			/* Write-behind is checked at event time. */
+			kn->kn_fop = &ugenwrite_async_filtops;
 			break;
 		default:
 			return (EINVAL);
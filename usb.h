@@ -642,14 +642,194 @@ struct usb_ctl_request {
 	int	ucr_flags;
 #define USBD_SHORT_XFER_OK	0x04	/* allow short reads */
 #define USBD_FORCE_SHORT_XFER	0x08	/* force last short packet on write */
+#define USBD_ZERO_COPY		0x100	/* data is in pool buffer ucr_slot */
 	int	ucr_actlen;		/* actual length transferred */
 	int 	ucr_timeout;
 	int 	ucr_status;
-	int 	ucr_read;
+	int 	ucr_read;		/* also picks the IN or OUT queue */
+	int	ucr_slot;		/* mapped pool buffer, USBD_ZERO_COPY */
+	int	ucr_nframes;		/* isoc: number of frames */
+	u_int16_t *ucr_frlengths;	/* isoc: frame lengths, actual on done */
+#define USB_MAX_FRAMES		1024
+	struct iovec *ucr_iov;		/* bulk/intr: segments, not ucr_data */
+	int	ucr_iovcnt;		/* 0 to use ucr_data */
+#define USB_MAX_IOV		16
 	void 	*ucr_sce;
 	void	*ucr_context;
 	void *xfer;
+	u_int16_t *frlengths;		/* kernel copy of ucr_frlengths */
+	struct iovec *iov;		/* kernel copy of ucr_iov */
+	struct timespec start;		/* submitted, for USB_GET_STATS */
 	TAILQ_ENTRY(usb_ctl_request) entries;
+	LIST_ENTRY(usb_ctl_request) hash_entries;
+};
+
+struct usb_ctl_requests {
+	struct usb_ctl_request *ucrs_reqs;	/* array of requests */
+	int	*ucrs_errors;		/* per-request errno (USB_DO_REQUESTS) */
+	int	ucrs_count;		/* number of requests */
+	int	ucrs_done;		/* number queued or reaped */
+#define USB_MAX_REQUESTS	64
+};
+
+/*
+ * Completion ring shared with userland through mmap(2).  The kernel
+ * fills entries at uc_head, userland consumes them at uc_tail; both
+ * indices run freely and are reduced modulo uc_size.  Data of read
+ * transfers is copied into the slot of its entry at uce_offset.
+ * Once mapped, a ring stays until the device detaches and can only be
+ * set up again with the same geometry.
+ */
+struct usb_cring_entry {
+	void		*uce_context;
+	int		 uce_status;
+	int		 uce_actlen;
+	u_int32_t	 uce_offset;	/* offset of the data in the mapping */
+	u_int32_t	 uce_pad;
+};
+
+struct usb_cring {
+	volatile u_int32_t uc_head;	/* next entry filled by the kernel */
+	volatile u_int32_t uc_tail;	/* next entry consumed by userland */
+	u_int32_t	uc_size;	/* number of entries, power of two */
+	u_int32_t	uc_slotsize;	/* data bytes per entry */
+	u_int32_t	uc_dataoff;	/* offset of the first data slot */
+	u_int32_t	uc_overflow;	/* completions left on the queue */
+};
+#define USB_CRING_ENTRY(r, i) \
+	((struct usb_cring_entry *)((r) + 1) + ((i) & ((r)->uc_size - 1)))
+
+struct usb_cring_setup {
+	u_int32_t	ucs_size;	/* number of entries, 0 to remove */
+	u_int32_t	ucs_slotsize;	/* largest read to place in the ring */
+	u_int32_t	ucs_mapsize;	/* length to mmap, filled in */
+#define USB_CRING_MAXSIZE	1024
+#define USB_CRING_MAXMAP	(4 * 1024 * 1024)
+};
+
+/*
+ * With USB_POOL_MAP the DMA buffers of the pool are not used for
+ * ordinary requests.  Userland maps buffer i at offset
+ * USB_POOL_MAPOFF + i * up_maxlen, up_maxlen being rounded to a page
+ * by USB_SET_POOL, and passes i in ucr_slot with USBD_ZERO_COPY; the
+ * ring entry of such a request has the offset of that buffer.  Once
+ * mapped, the pool stays until the device detaches.
+ */
+struct usb_pool {
+	int		up_count;	/* number of preallocated requests */
+	int		up_maxlen;	/* DMA buffer size of each request */
+	int		up_flags;
+#define USB_POOL_MAP		0x01	/* buffers are for USBD_ZERO_COPY */
+	int		up_free;	/* requests not in use */
+	u_int64_t	up_hits;	/* submits served from the pool */
+	u_int64_t	up_misses;	/* submits that had to allocate */
+#define USB_POOL_MAXCOUNT	256
+#define USB_POOL_MAXLEN		65536
+#define USB_POOL_MAPOFF		0x10000000
+};
+
+/*
+ * Completion wakeup coalescing: pollers are woken once uac_count
+ * completions are queued or uac_usec after the first one that was
+ * held back.  A count of 0 or 1 wakes on every completion.
+ */
+struct usb_async_coalesce {
+	int		uac_count;
+	int		uac_usec;
+#define USB_COALESCE_MAXCOUNT	1024
+#define USB_COALESCE_MAXUSEC	1000000
+};
+
+/*
+ * Bulk IN read-ahead: ubr_depth transfers of ubr_xfersize bytes are kept
+ * in flight into a kernel ring of ubr_bufsize bytes that read(2) drains.
+ * When the ring is full the oldest data is dropped and counted.  A
+ * transfer that fails is started again, unless the endpoint stalled;
+ * once none is left read(2) fails with EIO.
+ */
+struct usb_bulk_ra {
+	int		ubr_xfersize;	/* bytes per transfer */
+	int		ubr_depth;	/* transfers in flight */
+	int		ubr_bufsize;	/* ring size, 0 for the default */
+	int		ubr_inflight;	/* transfers still running */
+	u_int64_t	ubr_overruns;	/* bytes dropped */
+#define USB_BULK_RA_MAXDEPTH	32
+#define USB_BULK_RA_MAXBUF	(4 * 1024 * 1024)
+};
+
+/*
+ * Bulk OUT write-behind: write(2) copies into a kernel ring of
+ * ubw_bufsize bytes that up to ubw_depth transfers of ubw_xfersize bytes
+ * drain in the background.  USB_BULK_WB_DRAIN waits until the ring is
+ * empty and returns the first error of a deferred transfer.
+ */
+struct usb_bulk_wb {
+	int		ubw_xfersize;	/* bytes per transfer */
+	int		ubw_depth;	/* transfers in flight */
+	int		ubw_bufsize;	/* ring size, 0 for the default */
+};
+
+/*
+ * Read ring of an isochronous IN endpoint: uig_xfers transfers of
+ * uig_xferframes packets each fill a ring of uig_frames packets, which
+ * has to hold at least two transfers.  The packet size includes the
+ * extra transactions of high-bandwidth endpoints.
+ */
+struct usb_isoc_geometry {
+	int		uig_frames;	/* ring size in packets */
+	int		uig_xfers;	/* transfers in flight */
+	int		uig_xferframes;	/* packets per transfer */
+	int		uig_pktsize;	/* bytes per packet, returned */
+#define USB_ISOC_MAXXFERS	32
+#define USB_ISOC_MAXXFERFRAMES	256
+#define USB_ISOC_MAXBUF		(4 * 1024 * 1024)
+};
+
+/*
+ * Interrupt IN packets are queued in a ring of uir_packets slots, a
+ * power of two.
+ * read(2) returns the data of one packet, or with USB_INTR_RECORDS as
+ * many whole records as fit: a struct usb_intr_packet followed by
+ * uip_len bytes of data, padded to USB_INTR_RECORD_SIZE.  Packets
+ * arriving while the ring is full are dropped and counted.  The ring
+ * cannot be resized while a read(2) is copying packets out.
+ */
+struct usb_intr_packet {
+	u_int32_t	uip_len;	/* bytes of data following */
+	u_int32_t	uip_pad;
+	struct timespec	uip_time;	/* arrival, CLOCK_MONOTONIC */
+};
+#define USB_INTR_RECORD_SIZE(len) \
+	(sizeof(struct usb_intr_packet) + (((len) + 7) & ~7))
+
+struct usb_intr_ring {
+	int		uir_packets;	/* ring size, 0 keeps the current */
+	int		uir_flags;
+#define USB_INTR_RECORDS	0x01	/* read returns records */
+	int		uir_queued;	/* packets waiting, returned */
+	u_int64_t	uir_drops;	/* packets dropped, returned */
+#define USB_INTR_MAXPACKETS	4096
+};
+
+/*
+ * Async request counters of an endpoint since it was opened.  Errors
+ * are counted by usbd_status, cancelled requests only as cancelled.
+ * Bucket i of ues_latency counts completions that took less than 2^i
+ * microseconds after submission, the last bucket everything slower.
+ */
+#define USB_STATS_NSTATUS	32
+#define USB_STATS_NLATENCY	32
+
+struct usb_endpoint_stats {
+	u_int64_t	ues_submitted;
+	u_int64_t	ues_completed;
+	u_int64_t	ues_cancelled;
+	u_int64_t	ues_errors[USB_STATS_NSTATUS];
+	u_int64_t	ues_bytes_in;
+	u_int64_t	ues_bytes_out;
+	u_int32_t	ues_submit_depth;	/* requests in flight */
+	u_int32_t	ues_complete_depth;	/* completions not reaped */
+	u_int64_t	ues_latency[USB_STATS_NLATENCY];
 };
 
 struct usb_alt_interface {
@@ -794,9 +974,29 @@ struct usb_device_stats {
 #define USB_SET_TIMEOUT		_IOW ('U', 114, int)
 #define USB_GET_COMPLETED	_IOWR('U', 115, struct usb_ctl_request)
 #define USB_CANCEL		_IOWR('U', 116, struct usb_ctl_request)
+#define USB_DO_REQUESTS		_IOWR('U', 117, struct usb_ctl_requests)
+#define USB_GET_COMPLETIONS	_IOWR('U', 118, struct usb_ctl_requests)
+#define USB_SET_CRING		_IOWR('U', 119, struct usb_cring_setup)
+#define USB_SET_POOL		_IOWR('U', 120, struct usb_pool)
+#define USB_GET_POOL		_IOR ('U', 121, struct usb_pool)
+#define USB_CANCEL_ALL		_IO  ('U', 122)
+#define USB_SET_BUFSIZE		_IOW ('U', 123, int)
+#define USB_GET_BUFSIZE		_IOR ('U', 124, int)
+#define USB_SET_BULK_RA		_IOWR('U', 125, struct usb_bulk_ra)
+#define USB_GET_BULK_RA		_IOR ('U', 126, struct usb_bulk_ra)
+#define USB_SET_BULK_WB		_IOWR('U', 127, struct usb_bulk_wb)
+#define USB_BULK_WB_DRAIN	_IO  ('U', 128)
+#define USB_SET_ISOC_GEOMETRY	_IOWR('U', 129, struct usb_isoc_geometry)
 
 /* Modem device */
 #define USB_GET_CM_OVER_DATA	_IOR ('U', 130, int)
 #define USB_SET_CM_OVER_DATA	_IOW ('U', 131, int)
 
+/* Generic USB device, continued */
+#define USB_SET_INTR_RING	_IOWR('U', 140, struct usb_intr_ring)
+#define USB_GET_INTR_RING	_IOR ('U', 141, struct usb_intr_ring)
+#define USB_SET_COALESCE	_IOWR('U', 142, struct usb_async_coalesce)
+#define USB_GET_COALESCE	_IOR ('U', 143, struct usb_async_coalesce)
+#define USB_GET_STATS		_IOR ('U', 144, struct usb_endpoint_stats)
+
 #endif /* _USB_H_ */
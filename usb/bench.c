@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2015 Grant Czajkowski <czajkow2@illinois.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/time.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <dev/usb/usb.h>
+#include <dev/usb/usbdi.h>
+
+#define BENCH_MAXEP	32
+#define BENCH_MAXDEPTH	64
+
+struct bench_ep {
+	pthread_t	 thread;
+	char		*dev;
+	int		 fd;
+	int		 nxfers;
+	int		 done;
+	int		 error;
+	char		*bufs[BENCH_MAXDEPTH];
+};
+
+void usage(void);
+int bench_submit(struct bench_ep *, int);
+void *bench_contention(void *);
+int main(int, char **);
+
+extern char *__progname;
+
+int depth = 16;
+int len = 16384;
+int nxfers = 1000;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-l len] [-n nxfers] [-q depth] "
+	    "devnode ...\n", __progname);
+	exit(1);
+}
+
+int
+bench_submit(struct bench_ep *ep, int slot)
+{
+	struct usb_ctl_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.ucr_data = ep->bufs[slot];
+	req.ucr_actlen = len;
+	req.ucr_flags = USBD_SHORT_XFER_OK;
+	req.ucr_timeout = USBD_DEFAULT_TIMEOUT;
+	req.ucr_read = 1;
+	req.ucr_context = (void *)(long)slot;
+
+	if (ioctl(ep->fd, USB_DO_REQUEST, &req))
+		return (errno);
+	return (0);
+}
+
+/*
+ * Keep depth bulk-in requests queued on one endpoint and reap/resubmit
+ * them until nxfers have completed.  One thread runs per endpoint so
+ * that every endpoint submits and reaps at the same time.
+ */
+void *
+bench_contention(void *arg)
+{
+	struct bench_ep *ep = arg;
+	struct usb_ctl_request req;
+	struct pollfd pfd;
+	int i, inflight = 0;
+
+	for (i = 0; i < depth && i < ep->nxfers; i++) {
+		if ((ep->error = bench_submit(ep, i)))
+			return (NULL);
+		inflight++;
+	}
+
+	pfd.fd = ep->fd;
+	pfd.events = POLLIN | POLLRDNORM;
+	while (inflight > 0) {
+		if (poll(&pfd, 1, INFTIM) < 0) {
+			ep->error = errno;
+			return (NULL);
+		}
+		while (ioctl(ep->fd, USB_GET_COMPLETED, &req) == 0) {
+			inflight--;
+			ep->done++;
+			if (ep->done + inflight >= ep->nxfers)
+				continue;
+			i = (int)(long)req.ucr_context;
+			if ((ep->error = bench_submit(ep, i)))
+				return (NULL);
+			inflight++;
+		}
+	}
+
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_ep eps[BENCH_MAXEP];
+	struct timeval start, end, diff;
+	const char *errstr;
+	double secs;
+	int ch, i, j, nep, total = 0;
+
+	while ((ch = getopt(argc, argv, "l:n:q:?")) != -1) {
+		switch (ch) {
+		case 'l':
+			len = strtonum(optarg, 1, 32768, &errstr);
+			if (errstr)
+				errx(1, "length is %s: %s", errstr, optarg);
+			break;
+		case 'n':
+			nxfers = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (errstr)
+				errx(1, "nxfers is %s: %s", errstr, optarg);
+			break;
+		case 'q':
+			depth = strtonum(optarg, 1, BENCH_MAXDEPTH, &errstr);
+			if (errstr)
+				errx(1, "depth is %s: %s", errstr, optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0 || argc > BENCH_MAXEP)
+		usage();
+	nep = argc;
+
+	memset(eps, 0, sizeof(eps));
+	for (i = 0; i < nep; i++) {
+		eps[i].dev = argv[i];
+		eps[i].nxfers = nxfers;
+		if ((eps[i].fd = open(argv[i], O_RDWR)) < 0 &&
+		    (eps[i].fd = open(argv[i], O_RDONLY)) < 0)
+			err(1, "%s", argv[i]);
+		for (j = 0; j < depth; j++)
+			if ((eps[i].bufs[j] = malloc(len)) == NULL)
+				err(1, NULL);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nep; i++)
+		if ((errno = pthread_create(&eps[i].thread, NULL,
+		    bench_contention, &eps[i])))
+			err(1, "pthread_create");
+	for (i = 0; i < nep; i++)
+		pthread_join(eps[i].thread, NULL);
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	for (i = 0; i < nep; i++) {
+		if (eps[i].error)
+			warnc(eps[i].error, "%s", eps[i].dev);
+		printf("%s: %d transfers\n", eps[i].dev, eps[i].done);
+		total += eps[i].done;
+		close(eps[i].fd);
+	}
+	printf("%d endpoints, depth %d, %d bytes: %d transfers in %.3fs, "
+	    "%.0f transfers/s\n", nep, depth, len, total, secs,
+	    secs > 0 ? total / secs : 0);
+
+	exit(0);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2015 Grant Czajkowski <czajkow2@illinois.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+
+#include <dev/usb/usb.h>
+
+#define BULKBENCH_MAXSIZES	16
+
+void usage(void);
+double bulkbench_run(int, int, char *, long long);
+int main(int, char **);
+
+extern char *__progname;
+
+int sizes[BULKBENCH_MAXSIZES] = { 1024, 4096, 16384, 65536 };
+int nsizes = 4;
+int wflag;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-w] [-b bufsize] [-t total] devnode\n",
+	    __progname);
+	exit(1);
+}
+
+/*
+ * Move total bytes through read(2) or write(2) with the kernel transfer
+ * size set to bufsize.  Userland always asks for the largest size, so
+ * only the number of transfers per system call changes.  Returns the
+ * throughput in bytes per second.
+ */
+double
+bulkbench_run(int fd, int bufsize, char *buf, long long total)
+{
+	struct timeval start, end, diff;
+	long long done = 0;
+	ssize_t n;
+	double secs;
+
+	if (ioctl(fd, USB_SET_BUFSIZE, &bufsize))
+		err(1, "USB_SET_BUFSIZE %d", bufsize);
+
+	gettimeofday(&start, NULL);
+	while (done < total) {
+		if (wflag)
+			n = write(fd, buf, sizes[nsizes - 1]);
+		else
+			n = read(fd, buf, sizes[nsizes - 1]);
+		if (n < 0)
+			err(1, "%s", wflag ? "write" : "read");
+		if (n == 0)
+			break;
+		done += n;
+	}
+	gettimeofday(&end, NULL);
+	timersub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	return (secs > 0 ? done / secs : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *errstr;
+	long long total = 16 * 1024 * 1024;
+	char *buf;
+	int bflag = 0;
+	int ch, fd, i, one = 1;
+
+	while ((ch = getopt(argc, argv, "b:t:w?")) != -1) {
+		switch (ch) {
+		case 'b':
+			if (!bflag)
+				nsizes = 0;
+			bflag = 1;
+			if (nsizes == BULKBENCH_MAXSIZES)
+				errx(1, "too many buffer sizes");
+			sizes[nsizes++] = strtonum(optarg, 1024, 64 * 1024,
+			    &errstr);
+			if (errstr)
+				errx(1, "bufsize is %s: %s", errstr, optarg);
+			break;
+		case 't':
+			total = strtonum(optarg, 1, LLONG_MAX, &errstr);
+			if (errstr)
+				errx(1, "total is %s: %s", errstr, optarg);
+			break;
+		case 'w':
+			wflag = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage();
+
+	if ((fd = open(argv[0], wflag ? O_WRONLY : O_RDONLY)) < 0)
+		err(1, "%s", argv[0]);
+	if (!wflag && ioctl(fd, USB_SET_SHORT_XFER, &one))
+		err(1, "USB_SET_SHORT_XFER");
+	for (i = 1; i < nsizes; i++)
+		if (sizes[i] < sizes[i - 1])
+			errx(1, "buffer sizes must be increasing");
+	if ((buf = malloc(sizes[nsizes - 1])) == NULL)
+		err(1, NULL);
+	memset(buf, 0, sizes[nsizes - 1]);
+
+	for (i = 0; i < nsizes; i++)
+		printf("%s %lld bytes, bufsize %6d: %8.0f KB/s\n",
+		    wflag ? "write" : "read", total, sizes[i],
+		    bulkbench_run(fd, sizes[i], buf, total) / 1024);
+
+	close(fd);
+	exit(0);
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2015 Grant Czajkowski <czajkow2@illinois.edu>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Stress test of the ugen(4) completion queue: a single-producer
+ * single-consumer ring whose slots are reserved when a request is
+ * started.  The ring operations mirror ugen_cq_put(), ugen_cq_get(),
+ * ugen_cq_pending() and ugen_cq_reap() with the membar_*() calls
+ * mapped to fences, so that the algorithm can be exercised in userland
+ * on any system with POSIX threads.
+ *
+ * One thread submits, one plays the completion callback, several
+ * reapers take turns on the ring and a poller checks the number of
+ * pending completions.  Every request must be reaped exactly once and
+ * in completion order.
+ */
+
+#include <sys/time.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CQSIZE		256	/* as UGEN_CQSIZE */
+#define CQTEST_MAXREAPERS	16
+
+#define membar_producer()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define membar_consumer()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define LOAD(x)			__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v)		__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+#ifndef __unused
+#define __unused		__attribute__((__unused__))
+#endif
+
+struct cq {
+	uintptr_t	ring[CQSIZE];
+	unsigned int	head;		/* written by the producer */
+	unsigned int	tail;		/* written under cq_lock */
+	unsigned int	reserved;	/* under q_lock */
+	pthread_mutex_t	cq_lock;	/* serializes reapers */
+	pthread_mutex_t	q_lock;
+};
+
+void usage(void);
+void cq_put(struct cq *, uintptr_t);
+uintptr_t cq_get(struct cq *);
+unsigned int cq_pending(struct cq *);
+void *submitter(void *);
+void *producer(void *);
+void *reaper(void *);
+void *poller(void *);
+int main(int, char **);
+
+extern char *__progname;
+
+struct cq cq;
+unsigned long nreqs = 1000000;
+int batch = 64;
+unsigned long submitted;	/* requests started, to the producer */
+unsigned long expected;		/* next request to reap, under cq_lock */
+int done;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-b batch] [-n requests] [-r reapers]\n",
+	    __progname);
+	exit(1);
+}
+
+/* ugen_cq_put() */
+void
+cq_put(struct cq *q, uintptr_t req)
+{
+	unsigned int head = LOAD(q->head);
+
+	STORE(q->ring[head & (CQSIZE - 1)], req);
+	membar_producer();
+	STORE(q->head, head + 1);
+}
+
+/* ugen_cq_get(), called with cq_lock held */
+uintptr_t
+cq_get(struct cq *q)
+{
+	uintptr_t req;
+	unsigned int tail = LOAD(q->tail);
+
+	if (tail == LOAD(q->head))
+		return (0);
+	membar_consumer();
+	req = LOAD(q->ring[tail & (CQSIZE - 1)]);
+	STORE(q->tail, tail + 1);
+	return (req);
+}
+
+/* ugen_cq_pending() */
+unsigned int
+cq_pending(struct cq *q)
+{
+	unsigned int tail = LOAD(q->tail);
+
+	membar_consumer();
+	return (LOAD(q->head) - tail);
+}
+
+/* ugen_start_request(): take a slot, then hand the request over. */
+void *
+submitter(void *arg __unused)
+{
+	unsigned long i;
+
+	for (i = 0; i < nreqs; i++) {
+		for (;;) {
+			pthread_mutex_lock(&cq.q_lock);
+			if (cq.reserved < CQSIZE)
+				break;
+			pthread_mutex_unlock(&cq.q_lock);
+			sched_yield();
+		}
+		cq.reserved++;
+		pthread_mutex_unlock(&cq.q_lock);
+		__atomic_store_n(&submitted, i + 1, __ATOMIC_RELEASE);
+	}
+	return (NULL);
+}
+
+/* ugen_async_callback(): complete the requests in submission order. */
+void *
+producer(void *arg __unused)
+{
+	unsigned long i;
+
+	for (i = 0; i < nreqs; i++) {
+		while (__atomic_load_n(&submitted, __ATOMIC_ACQUIRE) <= i)
+			sched_yield();
+		cq_put(&cq, i + 1);
+	}
+	return (NULL);
+}
+
+/* ugen_cq_reap() */
+void *
+reaper(void *arg __unused)
+{
+	uintptr_t req;
+	int n;
+
+	while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&cq.cq_lock);
+		for (n = 0; n < batch; n++) {
+			if ((req = cq_get(&cq)) == 0)
+				break;
+			if (req != expected + 1)
+				errx(1, "reaped request %lu, expected %lu",
+				    (unsigned long)req, expected + 1);
+			expected++;
+		}
+		if (expected == nreqs)
+			__atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&cq.cq_lock);
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+
+		pthread_mutex_lock(&cq.q_lock);
+		if (cq.reserved < (unsigned int)n)
+			errx(1, "reserved %u, reaped %d", cq.reserved, n);
+		cq.reserved -= n;
+		pthread_mutex_unlock(&cq.q_lock);
+	}
+	return (NULL);
+}
+
+/*
+ * ugenpoll(): the pending count must never go negative, and must stay
+ * within the ring if no reaper moved in the meantime.
+ */
+void *
+poller(void *arg __unused)
+{
+	unsigned int pending, tail;
+
+	while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+		tail = LOAD(cq.tail);
+		membar_consumer();
+		pending = cq_pending(&cq);
+		membar_consumer();
+		if (pending > nreqs ||
+		    (pending > CQSIZE && LOAD(cq.tail) == tail))
+			errx(1, "%u completions pending", pending);
+		sched_yield();
+	}
+	return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t sub, prod, poll, reapers[CQTEST_MAXREAPERS];
+	struct timeval start, end;
+	double secs;
+	int ch, i, nreapers = 2;
+
+	while ((ch = getopt(argc, argv, "b:n:r:?")) != -1) {
+		switch (ch) {
+		case 'b':
+			batch = atoi(optarg);
+			if (batch <= 0)
+				errx(1, "invalid batch: %s", optarg);
+			break;
+		case 'n':
+			nreqs = strtoul(optarg, NULL, 10);
+			if (nreqs == 0)
+				errx(1, "invalid requests: %s", optarg);
+			break;
+		case 'r':
+			nreapers = atoi(optarg);
+			if (nreapers <= 0 || nreapers > CQTEST_MAXREAPERS)
+				errx(1, "invalid reapers: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0)
+		usage();
+
+	pthread_mutex_init(&cq.cq_lock, NULL);
+	pthread_mutex_init(&cq.q_lock, NULL);
+
+	gettimeofday(&start, NULL);
+	pthread_create(&sub, NULL, submitter, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_create(&poll, NULL, poller, NULL);
+	for (i = 0; i < nreapers; i++)
+		pthread_create(&reapers[i], NULL, reaper, NULL);
+
+	pthread_join(sub, NULL);
+	pthread_join(prod, NULL);
+	for (i = 0; i < nreapers; i++)
+		pthread_join(reapers[i], NULL);
+	pthread_join(poll, NULL);
+	gettimeofday(&end, NULL);
+
+	if (expected != nreqs || cq.reserved != 0 || cq.head != cq.tail)
+		errx(1, "reaped %lu of %lu, %u slots still reserved",
+		    expected, nreqs, cq.reserved);
+	secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%lu requests, %d reapers: ok, %.0f requests/s\n",
+	    nreqs, nreapers, nreqs / secs);
+	return (0);
+}